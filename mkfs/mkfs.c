@@ -0,0 +1,416 @@
+/*
+ * mkfs -- build a version 2 filesystem image from a directory tree
+ *
+ *   mkfs -i <dir> -o <image> [-n <spare inodes>] [-z]
+ *
+ * The image starts with a superblock, then a table of 256-byte inodes, then
+ * 4KB data blocks. Every file and directory is written as one run of blocks,
+ * so each inode needs a single extent. Directories hold 64-byte entries like
+ * the version 1 boot block, subdirectories included, and the root gets an
+ * "rtc" entry for the real time clock like createfs adds. With -z, regular
+ * files are LZ4 compressed block by block when that saves space, the kernel
+ * decompresses blocks as they are read. The layout must match
+ * student-distrib/fs.h.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE        4096
+#define FILENAME_MAX_CHAR 32
+#define DENTRY_SIZE       64
+#define MAX_DEPTH         16 /* deeper directories are not loaded by the kernel */
+
+#define FS2_MAGIC         0x46313933
+#define FS2_VERSION       2
+#define FS2_INODE_SIZE    256
+#define FS_FEATURE_DIRS   0x1
+#define FS_FEATURE_LZ4    0x2
+#define FS2_INODE_LZ4     0x1
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_MF_LIMIT      12  /* no match starts in the last 12 bytes of a block */
+#define LZ4_LAST_LITERALS 5   /* and the last 5 bytes are literals */
+#define LZ4_HASH_BITS     12
+
+#define TYPE_RTC          0
+#define TYPE_DIR          1
+#define TYPE_REGULAR      2
+
+#define DEFAULT_SPARE     64
+
+typedef struct node {
+    char name[FILENAME_MAX_CHAR + 1];
+    uint32_t type;
+    uint32_t inode;
+    uint32_t length;      /* bytes of data, entries for a directory */
+    uint32_t start;       /* first data block */
+    uint8_t *packed;      /* compressed data with its offset table, NULL if stored as is */
+    uint32_t stored;      /* bytes of packed */
+    char *path;           /* on the host, NULL for rtc */
+    struct node *parent;
+    struct node **children;
+    uint32_t nr_children;
+} node_t;
+
+static node_t **inodes;   /* by inode number */
+static uint32_t nr_inodes;
+
+static void *xmalloc(size_t size)
+{
+    void *p = calloc(1, size ? size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "mkfs: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp((*(node_t * const *)a)->name, (*(node_t * const *)b)->name);
+}
+
+static node_t *new_node(const char *name, uint32_t type, char *path, node_t *parent)
+{
+    node_t *n = xmalloc(sizeof(node_t));
+
+    memcpy(n->name, name, strnlen(name, FILENAME_MAX_CHAR));
+    n->type = type;
+    n->path = path;
+    n->parent = parent;
+    return n;
+}
+
+static void add_child(node_t *dir, node_t *child)
+{
+    dir->children = realloc(dir->children, (dir->nr_children + 1) * sizeof(node_t *));
+    if (dir->children == NULL) {
+        fprintf(stderr, "mkfs: out of memory\n");
+        exit(1);
+    }
+    dir->children[dir->nr_children++] = child;
+}
+
+/* read a host directory into dir, recursively */
+static void scan(node_t *dir, uint32_t depth)
+{
+    DIR *d = opendir(dir->path);
+    struct dirent *de;
+    struct stat st;
+    node_t *child;
+    char *path;
+    uint32_t i;
+
+    if (d == NULL) {
+        fprintf(stderr, "mkfs: %s: %s\n", dir->path, strerror(errno));
+        exit(1);
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        path = xmalloc(strlen(dir->path) + strlen(de->d_name) + 2);
+        sprintf(path, "%s/%s", dir->path, de->d_name);
+        if (stat(path, &st) == -1) {
+            fprintf(stderr, "mkfs: %s: %s\n", path, strerror(errno));
+            exit(1);
+        }
+        if (strlen(de->d_name) > FILENAME_MAX_CHAR)
+            fprintf(stderr, "mkfs: %s: name cut to %d characters\n", path, FILENAME_MAX_CHAR);
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth + 1 >= MAX_DEPTH) {
+                fprintf(stderr, "mkfs: %s: too deep, skipped\n", path);
+                free(path);
+                continue;
+            }
+            child = new_node(de->d_name, TYPE_DIR, path, dir);
+            scan(child, depth + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            child = new_node(de->d_name, TYPE_REGULAR, path, dir);
+            child->length = st.st_size;
+        } else {
+            free(path);
+            continue;
+        }
+        add_child(dir, child);
+    }
+    closedir(d);
+
+    qsort(dir->children, dir->nr_children, sizeof(node_t *), by_name);
+    for (i = 1; i < dir->nr_children; i++) {
+        if (!strcmp(dir->children[i - 1]->name, dir->children[i]->name)) {
+            fprintf(stderr, "mkfs: %s: two names cut to %s\n", dir->path, dir->children[i]->name);
+            exit(1);
+        }
+    }
+}
+
+/* number the inodes depth first, the root is 0 */
+static void number(node_t *n)
+{
+    uint32_t i;
+
+    if (n->type == TYPE_RTC)
+        return;
+    n->inode = nr_inodes++;
+    inodes = realloc(inodes, nr_inodes * sizeof(node_t *));
+    if (inodes == NULL) {
+        fprintf(stderr, "mkfs: out of memory\n");
+        exit(1);
+    }
+    inodes[n->inode] = n;
+
+    if (n->type == TYPE_DIR) {
+        /* ".", ".." (not in the root), then the children */
+        n->length = (n->nr_children + 1 + (n->parent != NULL)) * DENTRY_SIZE;
+        for (i = 0; i < n->nr_children; i++)
+            number(n->children[i]);
+    }
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put_dentry(uint8_t *p, const char *name, uint32_t type, uint32_t inode)
+{
+    memcpy(p, name, strnlen(name, FILENAME_MAX_CHAR));
+    put32(p + FILENAME_MAX_CHAR, type);
+    put32(p + FILENAME_MAX_CHAR + 4, inode);
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* append a length past the 15 a token nibble holds */
+static uint8_t *put_length(uint8_t *op, uint32_t len)
+{
+    for (len -= 15; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* append a sequence: literals, then a match unless match_len is 0 */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint8_t *token = op++;
+    uint32_t ml = match_len ? match_len - LZ4_MIN_MATCH : 0;
+
+    *token = ((lit_len < 15) ? lit_len : 15) << 4;
+    if (lit_len >= 15)
+        op = put_length(op, lit_len);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0)
+        return op;
+
+    *op++ = offset;
+    *op++ = offset >> 8;
+    *token |= (ml < 15) ? ml : 15;
+    if (ml >= 15)
+        op = put_length(op, ml);
+    return op;
+}
+
+/*
+ * Compress one block in LZ4 block format, greedily taking the last earlier
+ * position with the same 4 bytes. Returns the compressed size, or 0 if it
+ * is not smaller than the block. dst must hold 2 * BLOCK_SIZE bytes.
+ */
+static uint32_t lz4_compress(const uint8_t *src, uint32_t n, uint8_t *dst)
+{
+    uint32_t table[1 << LZ4_HASH_BITS]; /* position + 1, 0 for none */
+    uint32_t ip = 0, anchor = 0, ref, len, h;
+    uint8_t *op = dst;
+
+    memset(table, 0, sizeof(table));
+    while (n >= LZ4_MF_LIMIT && ip <= n - LZ4_MF_LIMIT) {
+        h = (read32(src + ip) * 2654435761U) >> (32 - LZ4_HASH_BITS);
+        ref = table[h];
+        table[h] = ip + 1;
+        if (ref == 0 || read32(src + ref - 1) != read32(src + ip)) {
+            ip++;
+            continue;
+        }
+        ref--;
+        for (len = LZ4_MIN_MATCH; ip + len < n - LZ4_LAST_LITERALS && src[ref + len] == src[ip + len]; len++)
+            ;
+        op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+    }
+    op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+    return ((uint32_t)(op - dst) < n) ? (uint32_t)(op - dst) : 0;
+}
+
+/* compress a regular file block by block, kept only if it needs fewer blocks */
+static void pack(node_t *n)
+{
+    uint32_t nr = (n->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t table_size = (nr + 1) * 4, i, size, len;
+    uint8_t *data = xmalloc(n->length), *out, tmp[2 * BLOCK_SIZE];
+    FILE *f;
+
+    f = fopen(n->path, "rb");
+    if (f == NULL || fread(data, 1, n->length, f) != n->length) {
+        fprintf(stderr, "mkfs: %s: cannot read\n", n->path);
+        exit(1);
+    }
+    fclose(f);
+
+    /* a block never grows, it is stored as is when it does not shrink */
+    out = xmalloc(table_size + n->length);
+    n->stored = table_size;
+    for (i = 0; i < nr; i++) {
+        size = (n->length - i * BLOCK_SIZE < BLOCK_SIZE) ? n->length - i * BLOCK_SIZE : BLOCK_SIZE;
+        len = lz4_compress(data + i * BLOCK_SIZE, size, tmp);
+        put32(out + i * 4, n->stored);
+        if (len == 0)
+            memcpy(out + n->stored, data + i * BLOCK_SIZE, size);
+        else
+            memcpy(out + n->stored, tmp, len);
+        n->stored += len ? len : size;
+    }
+    put32(out + nr * 4, n->stored);
+    free(data);
+
+    if ((n->stored + BLOCK_SIZE - 1) / BLOCK_SIZE < nr)
+        n->packed = out;
+    else
+        free(out);
+}
+
+/* fill the data blocks of one inode */
+static void write_data(uint8_t *dst, node_t *n)
+{
+    FILE *f;
+    uint32_t i;
+
+    if (n->type == TYPE_DIR) {
+        put_dentry(dst, ".", TYPE_DIR, n->inode);
+        dst += DENTRY_SIZE;
+        if (n->parent != NULL) {
+            put_dentry(dst, "..", TYPE_DIR, n->parent->inode);
+            dst += DENTRY_SIZE;
+        }
+        for (i = 0; i < n->nr_children; i++, dst += DENTRY_SIZE)
+            put_dentry(dst, n->children[i]->name, n->children[i]->type, n->children[i]->inode);
+        return;
+    }
+    if (n->packed != NULL) {
+        memcpy(dst, n->packed, n->stored);
+        return;
+    }
+
+    f = fopen(n->path, "rb");
+    if (f == NULL || fread(dst, 1, n->length, f) != n->length) {
+        fprintf(stderr, "mkfs: %s: cannot read\n", n->path);
+        exit(1);
+    }
+    fclose(f);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mkfs -i <dir> -o <image> [-n <spare inodes>] [-z]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *in = NULL, *out = NULL;
+    uint32_t spare = DEFAULT_SPARE;
+    uint32_t total_inodes, inode_blocks, data_blocks, nr_blocks, i;
+    uint32_t features = FS_FEATURE_DIRS, compress = 0, raw_blocks = 0, stored;
+    uint8_t *image, *p;
+    node_t *root;
+    FILE *f;
+
+    for (i = 1; i < (uint32_t)argc; i++) {
+        if (!strcmp(argv[i], "-i") && i + 1 < (uint32_t)argc)
+            in = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < (uint32_t)argc)
+            out = argv[++i];
+        else if (!strcmp(argv[i], "-n") && i + 1 < (uint32_t)argc)
+            spare = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-z"))
+            compress = 1;
+        else
+            usage();
+    }
+    if (in == NULL || out == NULL)
+        usage();
+
+    root = new_node("", TYPE_DIR, (char *)in, NULL);
+    scan(root, 0);
+    for (i = 0; i < root->nr_children && strcmp(root->children[i]->name, "rtc"); i++)
+        ;
+    if (i == root->nr_children)
+        add_child(root, new_node("rtc", TYPE_RTC, NULL, root));
+    number(root);
+
+    /* one run of blocks per inode */
+    total_inodes = nr_inodes + spare;
+    inode_blocks = (total_inodes * FS2_INODE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    data_blocks = 0;
+    for (i = 0; i < nr_inodes; i++) {
+        if (compress && inodes[i]->type == TYPE_REGULAR && inodes[i]->length > 0)
+            pack(inodes[i]);
+        if (inodes[i]->packed != NULL)
+            features |= FS_FEATURE_LZ4;
+        stored = inodes[i]->packed ? inodes[i]->stored : inodes[i]->length;
+        inodes[i]->start = data_blocks;
+        data_blocks += (stored + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        raw_blocks += (inodes[i]->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+    nr_blocks = 1 + inode_blocks + data_blocks;
+
+    image = xmalloc((size_t)nr_blocks * BLOCK_SIZE);
+    put32(image, FS2_MAGIC);
+    put32(image + 4, FS2_VERSION);
+    put32(image + 8, features);
+    put32(image + 12, total_inodes);
+    put32(image + 16, data_blocks);
+    put32(image + 20, 1);
+    put32(image + 24, 1 + inode_blocks);
+    put32(image + 28, root->inode);
+
+    for (i = 0; i < nr_inodes; i++) {
+        p = image + BLOCK_SIZE + i * FS2_INODE_SIZE;
+        put32(p, inodes[i]->length);
+        if (inodes[i]->length == 0)
+            continue;
+        stored = inodes[i]->packed ? inodes[i]->stored : inodes[i]->length;
+        put32(p + 4, 1 | (inodes[i]->packed ? FS2_INODE_LZ4 << 16 : 0)); /* nr_extents, flags */
+        put32(p + 8, inodes[i]->start);
+        put32(p + 12, (stored + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        write_data(image + (size_t)(1 + inode_blocks + inodes[i]->start) * BLOCK_SIZE, inodes[i]);
+    }
+
+    f = fopen(out, "wb");
+    if (f == NULL || fwrite(image, BLOCK_SIZE, nr_blocks, f) != nr_blocks || fclose(f) != 0) {
+        fprintf(stderr, "mkfs: %s: cannot write\n", out);
+        return 1;
+    }
+    printf("%s: %u inodes (%u spare), %u data blocks, %u KB\n", out, total_inodes, spare, data_blocks,
+           nr_blocks * (BLOCK_SIZE / 1024));
+    if (compress)
+        printf("%s: compressed %u data blocks into %u\n", out, raw_blocks, data_blocks);
+    return 0;
+}
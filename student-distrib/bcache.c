@@ -0,0 +1,183 @@
+#include "bcache.h"
+#include "mm.h"
+
+static bcache_entry_t bcache[BCACHE_SIZE];
+static bcache_entry_t *buckets[BCACHE_BUCKETS];
+static bcache_entry_t lru; // list head, lru.next is the most recently used slot
+static bcache_stats_t bcache_stats;
+
+/*
+ * block_hash
+ * Description: pick the hash chain of a block
+ *  Inputs: inode, block -- index inside the file
+ *  Outputs: chain index
+ * Side Effects: None.
+ */
+static uint32_t block_hash(uint32_t inode, uint32_t block)
+{
+    return (inode * 2654435761U + block) & (BCACHE_BUCKETS - 1);
+}
+
+/*
+ * lru_unlink
+ * Description: take a slot off the LRU list
+ *  Inputs: slot
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void lru_unlink(bcache_entry_t *slot)
+{
+    slot->prev->next = slot->next;
+    slot->next->prev = slot->prev;
+}
+
+/*
+ * lru_push
+ * Description: put a slot at the most recently used end of the LRU list
+ *  Inputs: slot -- not on the list
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void lru_push(bcache_entry_t *slot)
+{
+    slot->next = lru.next;
+    slot->prev = &lru;
+    lru.next->prev = slot;
+    lru.next = slot;
+}
+
+/*
+ * unhash
+ * Description: take a valid slot off its hash chain and mark it empty
+ *  Inputs: slot
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void unhash(bcache_entry_t *slot)
+{
+    bcache_entry_t **link = &buckets[block_hash(slot->inode, slot->block)];
+
+    while (*link != slot)
+        link = &((*link)->hnext);
+    *link = slot->hnext;
+    slot->hnext = NULL;
+    slot->valid = 0;
+}
+
+/*
+ * bcache_init
+ * Description: empty the cache, every slot goes on the LRU list
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: frames are only taken when slots are first used.
+ */
+void bcache_init(void)
+{
+    int i;
+
+    lru.next = lru.prev = &lru;
+    for (i = 0; i < BCACHE_BUCKETS; i++)
+        buckets[i] = NULL;
+    for (i = 0; i < BCACHE_SIZE; i++)
+    {
+        bcache[i].valid = 0;
+        bcache[i].hnext = NULL;
+        lru_push(&bcache[i]);
+    }
+}
+
+/*
+ * bcache_lookup
+ * Description: look a block up in the cache
+ *  Inputs: inode, block -- index inside the file
+ *  Outputs: address of the decompressed block on a hit, 0 on a miss
+ * Side Effects: counts the hit or miss, a hit becomes the most recently used block.
+ */
+uint32_t bcache_lookup(uint32_t inode, uint32_t block)
+{
+    bcache_entry_t *slot;
+
+    for (slot = buckets[block_hash(inode, block)]; slot != NULL; slot = slot->hnext)
+    {
+        if (slot->inode == inode && slot->block == block)
+        {
+            lru_unlink(slot);
+            lru_push(slot);
+            bcache_stats.hits++;
+            return slot->addr;
+        }
+    }
+    bcache_stats.misses++;
+    return 0;
+}
+
+/*
+ * bcache_alloc
+ * Description: give a block the least recently used slot, the caller fills in its data
+ *  Inputs: inode, block -- index inside the file, not cached
+ *  Outputs: address of the 4KB frame to fill, 0 when out of memory
+ * Side Effects: the block that used the slot is evicted. A caller that fails to fill
+ *               the frame must bcache_invalidate the file.
+ */
+uint32_t bcache_alloc(uint32_t inode, uint32_t block)
+{
+    bcache_entry_t *slot = lru.prev;
+
+    if (slot->addr == 0)
+    {
+        slot->addr = alloc_frames(0);
+        if (slot->addr == 0)
+            return 0;
+    }
+    if (slot->valid)
+    {
+        unhash(slot);
+        bcache_stats.evictions++;
+    }
+
+    slot->inode = inode;
+    slot->block = block;
+    slot->valid = 1;
+    slot->hnext = buckets[block_hash(inode, block)];
+    buckets[block_hash(inode, block)] = slot;
+    lru_unlink(slot);
+    lru_push(slot);
+    return slot->addr;
+}
+
+/*
+ * bcache_invalidate
+ * Description: drop every cached block of a file, its slots are reused first
+ *  Inputs: inode
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void bcache_invalidate(uint32_t inode)
+{
+    int i;
+
+    for (i = 0; i < BCACHE_SIZE; i++)
+    {
+        if (bcache[i].valid && bcache[i].inode == inode)
+        {
+            unhash(&bcache[i]);
+            lru_unlink(&bcache[i]);
+            bcache[i].next = &lru;
+            bcache[i].prev = lru.prev;
+            lru.prev->next = &bcache[i];
+            lru.prev = &bcache[i];
+        }
+    }
+}
+
+/*
+ * bcache_get_stats
+ * Description: report the hit, miss and eviction counters
+ *  Inputs: stats -- filled in
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void bcache_get_stats(bcache_stats_t *stats)
+{
+    *stats = bcache_stats;
+}
@@ -0,0 +1,47 @@
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+
+#define BCACHE_SIZE 64    // decompressed blocks kept, one 4KB frame each
+#define BCACHE_BUCKETS 64 // hash chains, power of two
+
+#ifndef ASM
+
+/* Cache of decompressed blocks of compressed files, keyed by inode and block
+ * inside the file. A full cache reuses the frame of the least recently used
+ * block. The data stays valid only until the next bcache_alloc, callers copy
+ * it out with interrupts off. */
+typedef struct bcache_entry
+{
+    uint32_t valid;
+    uint32_t inode;
+    uint32_t block;
+    uint32_t addr;              // frame of the data, 0 until the slot is first used
+    struct bcache_entry *prev;  // LRU list, most recently used first
+    struct bcache_entry *next;
+    struct bcache_entry *hnext; // hash chain
+} bcache_entry_t;
+
+typedef struct bcache_stats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} bcache_stats_t;
+
+/* =========================== function declarations =========================== */
+
+// start with every slot empty
+extern void bcache_init(void);
+// find a cached block, its address on a hit, 0 on a miss
+extern uint32_t bcache_lookup(uint32_t inode, uint32_t block);
+// take a slot for a block the caller fills in, its address, 0 when out of memory
+extern uint32_t bcache_alloc(uint32_t inode, uint32_t block);
+// forget every block of a file
+extern void bcache_invalidate(uint32_t inode);
+// hit, miss and eviction counters since boot
+extern void bcache_get_stats(bcache_stats_t *stats);
+
+#endif /* ASM */
+#endif /* _BCACHE_H */
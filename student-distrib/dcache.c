@@ -0,0 +1,100 @@
+#include "dcache.h"
+#include "lib.h"
+
+static dcache_entry_t dcache[DCACHE_SIZE];
+static dcache_stats_t dcache_stats;
+
+/*
+ * path_hash
+ * Description: FNV-1a over a path
+ *  Inputs: path -- shorter than DCACHE_PATH_MAX
+ *  Outputs: hash
+ * Side Effects: None.
+ */
+static uint32_t path_hash(const int8_t *path)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *path != '\0'; path++)
+    {
+        hash ^= (uint8_t)*path;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * dcache_lookup
+ * Description: look a path up in the cache
+ *  Inputs: path, dentry -- filled in on a hit
+ *  Outputs: 0 on a hit, -1 on a miss
+ * Side Effects: counts the hit or miss.
+ */
+int32_t dcache_lookup(const int8_t *path, dentry_t *dentry)
+{
+    dcache_entry_t *slot;
+
+    if (strlen(path) >= DCACHE_PATH_MAX)
+    {
+        dcache_stats.misses++;
+        return -1;
+    }
+
+    slot = &dcache[path_hash(path) & (DCACHE_SIZE - 1)];
+    if (!slot->valid || strncmp(slot->path, path, DCACHE_PATH_MAX))
+    {
+        dcache_stats.misses++;
+        return -1;
+    }
+
+    *dentry = slot->dentry;
+    dcache_stats.hits++;
+    return 0;
+}
+
+/*
+ * dcache_insert
+ * Description: cache what a path resolved to, replacing the slot's old path
+ *  Inputs: path, dentry
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void dcache_insert(const int8_t *path, const dentry_t *dentry)
+{
+    dcache_entry_t *slot;
+
+    if (strlen(path) >= DCACHE_PATH_MAX)
+        return;
+
+    slot = &dcache[path_hash(path) & (DCACHE_SIZE - 1)];
+    strncpy(slot->path, path, DCACHE_PATH_MAX);
+    slot->dentry = *dentry;
+    slot->valid = 1;
+}
+
+/*
+ * dcache_flush
+ * Description: drop every cached path
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void dcache_flush(void)
+{
+    int i;
+
+    for (i = 0; i < DCACHE_SIZE; i++)
+        dcache[i].valid = 0;
+}
+
+/*
+ * dcache_get_stats
+ * Description: report the hit and miss counters
+ *  Inputs: stats -- filled in
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void dcache_get_stats(dcache_stats_t *stats)
+{
+    *stats = dcache_stats;
+}
@@ -0,0 +1,40 @@
+#ifndef _DCACHE_H
+#define _DCACHE_H
+
+#include "types.h"
+#include "fs.h"
+
+#define DCACHE_SIZE 256    // slots, power of two
+#define DCACHE_PATH_MAX 64 // longer paths are walked every time
+
+#ifndef ASM
+
+/* Cache of path lookups. Direct mapped by a hash of the whole path, a new
+ * path simply replaces whatever shared its slot. Only names that exist are
+ * cached, so creating a file never leaves a stale slot behind; unlinking one does. */
+typedef struct dcache_entry
+{
+    uint32_t valid;
+    int8_t path[DCACHE_PATH_MAX];
+    dentry_t dentry;
+} dcache_entry_t;
+
+typedef struct dcache_stats
+{
+    uint32_t hits;
+    uint32_t misses;
+} dcache_stats_t;
+
+/* =========================== function declarations =========================== */
+
+// copy the cached dentry of a path, 0 on a hit, -1 on a miss
+extern int32_t dcache_lookup(const int8_t *path, dentry_t *dentry);
+// remember what a path resolved to
+extern void dcache_insert(const int8_t *path, const dentry_t *dentry);
+// forget every path, a name went away
+extern void dcache_flush(void);
+// hit and miss counters since boot
+extern void dcache_get_stats(dcache_stats_t *stats);
+
+#endif /* ASM */
+#endif /* _DCACHE_H */
@@ -0,0 +1,215 @@
+#include "dir_index.h"
+#include "kmalloc.h"
+#include "lib.h"
+
+/*
+ * name_hash
+ * Description: FNV-1a over a file name, names fill FILENAME_MAX_CHAR bytes without EOS
+ *  Inputs: name
+ *  Outputs: hash
+ * Side Effects: None.
+ */
+static uint32_t name_hash(const int8_t *name)
+{
+    uint32_t hash = 2166136261U;
+    int i;
+
+    for (i = 0; i < FILENAME_MAX_CHAR && name[i] != '\0'; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * resize
+ * Description: move every hashed entry into a table of a new size
+ *  Inputs: index, entries, nr_buckets -- power of two, capacity -- bigger than every hashed entry index
+ *  Outputs: 0 for success, -1 when out of memory (the old table is kept)
+ * Side Effects: None.
+ */
+static int32_t resize(dir_index_t *index, const dentry_t *entries, uint32_t nr_buckets, uint32_t capacity)
+{
+    int32_t *buckets, *chain;
+    int32_t i, next;
+    uint32_t b, nb;
+
+    buckets = kmalloc(nr_buckets * sizeof(int32_t));
+    chain = kmalloc(capacity * sizeof(int32_t));
+    if (buckets == NULL || chain == NULL)
+    {
+        kfree(buckets);
+        kfree(chain);
+        return -1;
+    }
+
+    for (b = 0; b < nr_buckets; b++)
+        buckets[b] = DIR_INDEX_NONE;
+    for (b = 0; b < capacity; b++)
+        chain[b] = DIR_INDEX_NONE;
+
+    for (b = 0; b < index->nr_buckets; b++)
+    {
+        for (i = index->buckets[b]; i != DIR_INDEX_NONE; i = next)
+        {
+            next = index->chain[i];
+            nb = name_hash(entries[i].filename) & (nr_buckets - 1);
+            chain[i] = buckets[nb];
+            buckets[nb] = i;
+        }
+    }
+
+    kfree(index->buckets);
+    kfree(index->chain);
+    index->buckets = buckets;
+    index->chain = chain;
+    index->nr_buckets = nr_buckets;
+    index->capacity = capacity;
+    return 0;
+}
+
+/*
+ * insert
+ * Description: hash an entry, the table must have room for it
+ *  Inputs: index, entries, i -- below index->capacity
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void insert(dir_index_t *index, const dentry_t *entries, uint32_t i)
+{
+    uint32_t b = name_hash(entries[i].filename) & (index->nr_buckets - 1);
+
+    index->chain[i] = index->buckets[b];
+    index->buckets[b] = i;
+    index->nr_entries++;
+}
+
+/*
+ * dir_index_build
+ * Description: hash every entry of a directory, empty names are free slots
+ *  Inputs: index -- uninitialized, entries, nr -- number of entries
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: None.
+ */
+int32_t dir_index_build(dir_index_t *index, const dentry_t *entries, uint32_t nr)
+{
+    uint32_t nr_buckets = DIR_INDEX_MIN_BUCKETS;
+    uint32_t i;
+
+    while (nr_buckets < nr)
+        nr_buckets <<= 1;
+
+    index->buckets = NULL;
+    index->chain = NULL;
+    index->nr_buckets = 0;
+    index->capacity = 0;
+    index->nr_entries = 0;
+    if (-1 == resize(index, entries, nr_buckets, nr_buckets))
+        return -1;
+
+    for (i = 0; i < nr; i++)
+    {
+        if (entries[i].filename[0] != '\0')
+            insert(index, entries, i);
+    }
+    return 0;
+}
+
+/*
+ * dir_index_free
+ * Description: free the hash table of a directory
+ *  Inputs: index
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void dir_index_free(dir_index_t *index)
+{
+    kfree(index->buckets);
+    kfree(index->chain);
+    index->buckets = NULL;
+    index->chain = NULL;
+    index->nr_buckets = 0;
+    index->capacity = 0;
+    index->nr_entries = 0;
+}
+
+/*
+ * dir_index_lookup
+ * Description: find a file name in a directory
+ *  Inputs: index, entries of the directory, name
+ *  Outputs: index of the entry, -1 if there is none
+ * Side Effects: None.
+ */
+int32_t dir_index_lookup(const dir_index_t *index, const dentry_t *entries, const int8_t *name)
+{
+    int32_t i;
+
+    if (index->nr_buckets == 0)
+        return -1;
+
+    for (i = index->buckets[name_hash(name) & (index->nr_buckets - 1)]; i != DIR_INDEX_NONE; i = index->chain[i])
+    {
+        if (!strncmp(entries[i].filename, name, FILENAME_MAX_CHAR))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * dir_index_add
+ * Description: hash a new entry, doubling the table first if it is full
+ *  Inputs: index, entries of the directory, i -- the new entry, already filled in
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: None.
+ */
+int32_t dir_index_add(dir_index_t *index, const dentry_t *entries, uint32_t i)
+{
+    uint32_t capacity = index->capacity;
+    uint32_t nr_buckets = index->nr_buckets;
+
+    if (nr_buckets == 0)
+        return -1; // never built
+
+    while (capacity <= i)
+        capacity <<= 1;
+    if (index->nr_entries >= nr_buckets)
+        nr_buckets <<= 1;
+
+    if (capacity != index->capacity || nr_buckets != index->nr_buckets)
+    {
+        if (-1 == resize(index, entries, nr_buckets, capacity))
+            return -1;
+    }
+
+    insert(index, entries, i);
+    return 0;
+}
+
+/*
+ * dir_index_remove
+ * Description: unhash an entry
+ *  Inputs: index, entries of the directory, i -- the entry, still holding its name
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void dir_index_remove(dir_index_t *index, const dentry_t *entries, uint32_t i)
+{
+    int32_t *link;
+
+    if (index->nr_buckets == 0 || i >= index->capacity)
+        return;
+
+    link = &(index->buckets[name_hash(entries[i].filename) & (index->nr_buckets - 1)]);
+    while (*link != DIR_INDEX_NONE)
+    {
+        if (*link == (int32_t)i)
+        {
+            *link = index->chain[i];
+            index->chain[i] = DIR_INDEX_NONE;
+            index->nr_entries--;
+            return;
+        }
+        link = &(index->chain[*link]);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _DIR_INDEX_H
+#define _DIR_INDEX_H
+
+#include "types.h"
+#include "fs.h"
+
+#define DIR_INDEX_MIN_BUCKETS 64 // power of two
+#define DIR_INDEX_NONE (-1)      // ends a chain
+
+#ifndef ASM
+
+/* Name hash of a directory, built at mount time. Chains hold indices into the
+ * directory's entry array, so the index never copies names. The bucket array
+ * doubles whenever entries outnumber buckets, lookups stay O(1) as a directory grows. */
+typedef struct dir_index
+{
+    uint32_t nr_buckets;
+    uint32_t capacity; // entries the chain array can hold
+    uint32_t nr_entries;
+    int32_t *buckets;  // first entry of each chain
+    int32_t *chain;    // next entry with the same bucket, by entry index
+} dir_index_t;
+
+/* =========================== function declarations =========================== */
+
+// index the first nr entries of a directory, -1 when out of memory
+extern int32_t dir_index_build(dir_index_t *index, const dentry_t *entries, uint32_t nr);
+// free the hash table
+extern void dir_index_free(dir_index_t *index);
+// find a name, the entry index or -1
+extern int32_t dir_index_lookup(const dir_index_t *index, const dentry_t *entries, const int8_t *name);
+// entries[i] was just filled in, -1 when out of memory
+extern int32_t dir_index_add(dir_index_t *index, const dentry_t *entries, uint32_t i);
+// entries[i] is about to be cleared
+extern void dir_index_remove(dir_index_t *index, const dentry_t *entries, uint32_t i);
+
+#endif /* ASM */
+#endif /* _DIR_INDEX_H */
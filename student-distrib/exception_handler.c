@@ -1,6 +1,8 @@
 #include "exception_handler.h"
 #include "lib.h"
 #include "syscall_handler.h"
+#include "fpu.h"
+#include "vm.h"
 
 /* Definitions for the exception handlers */
 
@@ -63,6 +65,10 @@ void EXCP_invalid_opcode(void *arg)
 // 0x07
 void EXCP_coprocessor_not_available(void *arg)
 {
+    // lazy FPU switch, restart the instruction with the right registers loaded
+    if (0 == fpu_handle_nm())
+        return;
+
     printf("coprocessor_not_available occured!\n");
     // asm volatile("hlt;");
     syscall_halt(0xFF);
@@ -117,13 +123,18 @@ void EXCP_general_protection_fault(void *arg)
 }
 
 // 0x0E
-void EXCP_page_fault(void *arg)
+void EXCP_page_fault(uint32_t error_code)
 {
     uint32_t page_fault_addr;
     asm volatile (
         "movl %%cr2, %0     \n\t"
         : "=r"(page_fault_addr)
     );
+
+    // user space is filled lazily and shared copy-on-write, back the page and retry the instruction
+    if (cur_pcb_ptr != NULL && 0 == vm_fault(cur_pcb_ptr, page_fault_addr, error_code))
+        return;
+
     printf("page fault address is: %x\n", page_fault_addr);
     printf("page_fault occured!\n");
     // asm volatile("hlt;");
@@ -1,6 +1,13 @@
 #ifndef _EXCEPTION_HANDLER_H
 #define _EXCEPTION_HANDLER_H
 
+#include "types.h"
+
+/* page fault error code bits */
+#define PF_PRESENT 0x01 // 0: page not present, 1: protection violation
+#define PF_WRITE 0x02   // caused by a write
+#define PF_USER 0x04    // happened in ring 3
+
 /* Declarations for the exception handlers */
 
 // 0x00
@@ -46,7 +53,7 @@ void EXCP_stack_segment_fault(void *arg);
 void EXCP_general_protection_fault(void *arg);
 
 // 0x0E
-void EXCP_page_fault(void *arg);
+void EXCP_page_fault(uint32_t error_code);
 
 // 0x0F (reserved)
 
@@ -0,0 +1,191 @@
+#include "fpu.h"
+#include "lib.h"
+#include "syscall_handler.h"
+#include "kmalloc.h"
+
+/* Lazy FPU/SSE switching.
+ * The registers stay loaded with the state of fpu_owner until another process
+ * actually executes an FPU or SSE instruction. schedule() only sets CR0.TS, the
+ * #NM that follows saves the owner's registers into its PCB and loads the
+ * current process's, so integer-only processes never pay for FXSAVE/FXRSTOR. */
+
+static PCB_t *fpu_owner = NULL;
+static uint8_t fpu_usable = 0; // CPU has FXSAVE/FXRSTOR and SSE, set up by fpu_init
+
+static inline void clts(void)
+{
+    asm volatile("clts" : : : "memory");
+}
+
+static inline void stts(void)
+{
+    asm volatile(
+        "movl %%cr0, %%eax      \n\t"
+        "orl %0, %%eax          \n\t"
+        "movl %%eax, %%cr0      \n\t"
+        :
+        : "i"(CR0_TS)
+        : "eax", "memory");
+}
+
+static inline void fxsave(fpu_state_t *state)
+{
+    asm volatile("fxsave (%0)" : : "r"(state) : "memory");
+}
+
+static inline void fxrstor(fpu_state_t *state)
+{
+    asm volatile("fxrstor (%0)" : : "r"(state) : "memory");
+}
+
+/*
+ * fpu_init
+ * Description: check for FXSR/SSE, enable them in CR0/CR4 and set CR0.TS
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: without FXSR the FPU stays off and #NM keeps killing the process.
+ */
+void fpu_init(void)
+{
+    uint32_t edx;
+
+    asm volatile(
+        "movl $1, %%eax     \n\t"
+        "cpuid              \n\t"
+        : "=d"(edx)
+        :
+        : "eax", "ebx", "ecx");
+
+    if ((edx & (CPUID_FXSR | CPUID_SSE)) != (CPUID_FXSR | CPUID_SSE))
+    {
+        printf("fpu: no FXSR/SSE, floating point disabled\n");
+        return;
+    }
+
+    asm volatile(
+        "movl %%cr0, %%eax      \n\t"
+        "andl %0, %%eax         \n\t"
+        "orl %1, %%eax          \n\t"
+        "movl %%eax, %%cr0      \n\t"
+
+        "movl %%cr4, %%eax      \n\t"
+        "orl %2, %%eax          \n\t"
+        "movl %%eax, %%cr4      \n\t"
+
+        "fninit                 \n\t"
+        :
+        : "i"(~(CR0_EM | CR0_TS)), "i"(CR0_MP | CR0_NE | CR0_TS), "i"(CR4_OSFXSR | CR4_OSXMMEXCPT)
+        : "eax", "memory");
+
+    fpu_usable = 1;
+}
+
+/*
+ * fpu_switch_to
+ * Description: set CR0.TS unless the next process still has its registers loaded
+ *  Inputs: next -- process about to run, NULL for the idle task
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void fpu_switch_to(PCB_t *next)
+{
+    if (!fpu_usable)
+        return;
+
+    if (next != NULL && next == fpu_owner)
+        clts();
+    else
+        stts();
+}
+
+/*
+ * fpu_release
+ * Description: drop the FPU state of a process
+ *  Inputs: pcb -- process that halts or is reloaded with a new program
+ *  Outputs: None
+ * Side Effects: the next FPU instruction of this pid starts from a clean state.
+ */
+void fpu_release(PCB_t *pcb)
+{
+    kfree(pcb->fpu_state);
+    pcb->fpu_state = NULL;
+    if (fpu_owner == pcb)
+    {
+        fpu_owner = NULL;
+        if (fpu_usable)
+            stts();
+    }
+}
+
+/*
+ * fpu_fork
+ * Description: copy the FPU state of the parent into a forked child
+ *  Inputs: parent -- the running process, child -- the new one
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: None.
+ */
+int32_t fpu_fork(PCB_t *parent, PCB_t *child)
+{
+    child->fpu_state = NULL;
+    if (parent->fpu_state == NULL)
+        return 0;
+
+    child->fpu_state = kmalloc(sizeof(fpu_state_t));
+    if (child->fpu_state == NULL)
+        return -1;
+
+    // the parent runs with CR0.TS clear exactly when it owns the registers
+    if (fpu_owner == parent)
+        fxsave(child->fpu_state);
+    else
+        memcpy(child->fpu_state, parent->fpu_state, sizeof(fpu_state_t));
+    return 0;
+}
+
+/*
+ * fpu_handle_nm
+ * Description: device-not-available, hand the FPU to the current process
+ *  Inputs: None
+ *  Outputs: 0 if the faulting instruction can be restarted, -1 otherwise
+ * Side Effects: saves the previous owner's registers into its PCB.
+ */
+int32_t fpu_handle_nm(void)
+{
+    PCB_t *pcb = cur_pcb_ptr;
+
+    if (!fpu_usable || pcb == NULL)
+        return -1;
+
+    clts();
+    if (fpu_owner == pcb)
+        return 0;
+
+    if (fpu_owner != NULL)
+        fxsave(fpu_owner->fpu_state);
+
+    if (pcb->fpu_state != NULL)
+    {
+        fxrstor(pcb->fpu_state);
+    }
+    else
+    {
+        // first FPU instruction of this process, start from the power-up state
+        uint32_t mxcsr = MXCSR_DEFAULT;
+
+        pcb->fpu_state = kmalloc(sizeof(fpu_state_t));
+        if (pcb->fpu_state == NULL)
+        {
+            fpu_owner = NULL;
+            return -1;
+        }
+        asm volatile(
+            "fninit             \n\t"
+            "ldmxcsr %0         \n\t"
+            :
+            : "m"(mxcsr)
+            : "memory");
+    }
+
+    fpu_owner = pcb;
+    return 0;
+}
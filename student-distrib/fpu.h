@@ -0,0 +1,44 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+
+/* CR0 / CR4 bits */
+#define CR0_MP 0x00000002     // WAIT/FWAIT also honors TS
+#define CR0_EM 0x00000004     // emulate x87, must be clear
+#define CR0_TS 0x00000008     // task switched, next FPU/SSE instruction raises #NM
+#define CR0_NE 0x00000020     // report x87 errors through exception 0x10
+#define CR4_OSFXSR 0x00000200     // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400 // SIMD errors through exception 0x13
+
+#define CPUID_FXSR 0x01000000 // cpuid(1) edx bit 24
+#define CPUID_SSE  0x02000000 // cpuid(1) edx bit 25
+
+#define FXSAVE_SIZE 512
+#define MXCSR_DEFAULT 0x1F80 // all SIMD exceptions masked, round to nearest
+
+#ifndef ASM
+
+// FXSAVE image of the x87/MMX/SSE registers, the instruction wants it 16-byte aligned
+typedef struct fpu_state
+{
+    uint8_t data[FXSAVE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+struct PCB;
+
+/* =========================== function declarations =========================== */
+
+// enable the FPU and SSE, leave CR0.TS set so the first use traps
+extern void fpu_init(void);
+// called on every context switch, arms the #NM trap unless next already owns the registers
+extern void fpu_switch_to(struct PCB *next);
+// forget the FPU state of a process that is going away or restarting
+extern void fpu_release(struct PCB *pcb);
+// give a forked child a copy of the parent's FPU registers, -1 when out of memory
+extern int32_t fpu_fork(struct PCB *parent, struct PCB *child);
+// #NM handler body, give the FPU to the current process
+extern int32_t fpu_handle_nm(void);
+
+#endif /* ASM */
+#endif /* _FPU_H */
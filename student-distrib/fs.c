@@ -2,35 +2,573 @@
 #include "lib.h"
 #include "terminal.h"
 #include "rtc.h"
+#include "paging.h"
+#include "dir_index.h"
+#include "kmalloc.h"
+#include "mm.h"
+#include "image.h"
+#include "dcache.h"
+#include "bcache.h"
+#include "lz4.h"
 
 dir_ops_t dir_ops;
 regular_file_ops_t regular_file_ops;
 rtc_ops_t rtc_ops;
 
-boot_block_t fs_blocks[TOTAL_BLOCK];
-boot_block_t boot_block;
+boot_block_t *boot_block;     // first block of the image, the module is mounted in place
+static boot_block_t empty_fs; // mounted when the module is missing or broken, no files
+static boot_block_t fs2_stats; // a version 2 image has no boot block, its counts go here
+static uint32_t fs_version;    // FS2_VERSION, or 1
+static uint32_t fs2_root_inode; // inode of the root directory of a version 2 image
+static inode_t **fs2_block_lists; // block list of a version 2 inode that has changed, NULL until then
+static inode_map_t *inode_maps; // extent map of every inode, checked once at mount
+static uint32_t nr_image_blocks; // data blocks in the module
+static uint32_t *extra_blocks;   // frame of data block nr_image_blocks + i, 0 if free
+static uint32_t *block_bitmap;   // bit set if a file owns the data block
+static uint32_t *inode_bitmap;   // bit set if a file owns the inode
 uint32_t data_block_start;
-uint32_t inode_start;
+uint32_t inode_start;     // first inode, 4KB apart in version 1, FS2_INODE_SIZE bytes in version 2
 
 file_ops_t stdin_ops;
 file_ops_t stdout_ops;
 
+/* a directory: its entries and their name hash */
+typedef struct fs_dir {
+    uint32_t inode;        // FS_ROOT_INODE for the root
+    dentry_t *entries;     // in the boot block for a version 1 root, otherwise copied out of the directory's data at mount
+    uint32_t nr_entries;
+    uint32_t capacity;     // a boot block holds MAX_FILES
+    dir_index_t index;
+    int32_t indexed;       // 0 if the index could not be built, lookups scan instead
+    struct fs_dir *parent; // the root is its own parent
+} fs_dir_t;
+
+static fs_dir_t root_dir;
+static fs_dir_t **dirs;    // subdirectory of each inode, NULL for files
+
+#define BIT_TEST(map, i) ((map)[(i) >> 5] & (1U << ((i) & 31)))
+#define BIT_SET(map, i) ((map)[(i) >> 5] |= (1U << ((i) & 31)))
+#define BIT_CLEAR(map, i) ((map)[(i) >> 5] &= ~(1U << ((i) & 31)))
+
+/* block_addr
+ * Description: find a data block in memory. Blocks of the image live in the module, blocks
+ *              created after boot are frames from mm.c, numbered after the image's.
+ * Inputs: data block number
+ * Outputs: address of the block; 0 if there is no such block.
+ * Side Effects: None.
+ */
+static uint32_t block_addr(uint32_t blk) {
+    if (blk < nr_image_blocks)
+        return data_block_start + blk * BLOCK_SIZE;
+    if (blk - nr_image_blocks < FS_EXTRA_BLOCKS && extra_blocks != NULL)
+        return extra_blocks[blk - nr_image_blocks];
+    return 0;
+}
+
+/* fs2_inode
+ * Description: find an inode of a version 2 image.
+ * Inputs: inode number
+ * Outputs: the inode in the image.
+ * Side Effects: None.
+ */
+static fs2_inode_t *fs2_inode(uint32_t inode) {
+    return (fs2_inode_t *)(inode_start + inode * FS2_INODE_SIZE);
+}
+
+/* inode_blocks
+ * Description: find the block list of an inode, the form writes change. A version 2 inode only has
+ *              extents, the first change gets it a block list in a frame of its own.
+ * Inputs: inode number
+ * Outputs: the inode; NULL if the file is too big for a block list, or out of memory.
+ * Side Effects: None.
+ */
+static inode_t *inode_blocks(uint32_t inode) {
+    fs2_inode_t *disk;
+    inode_t *list;
+    uint32_t i, j, n = 0;
+
+    if (fs_version != FS2_VERSION)
+        return (inode_t *)(inode * BLOCK_SIZE + inode_start);
+    if (fs2_block_lists[inode] != NULL)
+        return fs2_block_lists[inode];
+
+    disk = fs2_inode(inode);
+    if (disk->length > MAX_FILE_SIZE || disk->nr_extents > FS2_INODE_EXTENTS)
+        return NULL;
+    list = (inode_t *)alloc_frames(0);
+    if (list == NULL)
+        return NULL;
+
+    list->length = disk->length;
+    for (i = 0; i < disk->nr_extents; i++) {
+        for (j = 0; j < disk->extents[i].nr_blocks && n < MAX_INODES_PER_FILE; j++)
+            list->inodes[n++] = disk->extents[i].start + j;
+    }
+    fs2_block_lists[inode] = list;
+    return list;
+}
+
+/* add_run
+ * Description: append blocks contiguous in memory to the extents of a file, merging with the last extent
+ *              if they follow it. Only counts extents when there is no array yet.
+ * Inputs: extents -- array to fill, or NULL
+ *         nr_extents, end -- extents so far and where the last one ends, updated
+ *         file_block -- index of the first block inside the file
+ *         addr, nr -- where the blocks are, how many.
+ * Outputs: None.
+ * Side Effects: None.
+ */
+static void add_run(extent_t *extents, uint32_t *nr_extents, uint32_t *end, uint32_t file_block, uint32_t addr, uint32_t nr) {
+    if (*nr_extents > 0 && addr == *end) {
+        if (extents != NULL)
+            extents[*nr_extents - 1].nr_blocks += nr;
+    } else {
+        if (extents != NULL) {
+            extents[*nr_extents].file_block = file_block;
+            extents[*nr_extents].addr = addr;
+            extents[*nr_extents].nr_blocks = nr;
+        }
+        (*nr_extents)++;
+    }
+    *end = addr + nr * BLOCK_SIZE;
+}
+
+/* collect_runs
+ * Description: check the blocks of an inode and turn them into extents. A version 2 inode that never
+ *              changed is read extent by extent, without looking at each block.
+ * Inputs: inode number
+ *         nr_blocks -- blocks the file length needs
+ *         extents -- array to fill, or NULL to count.
+ * Outputs: number of extents; -1 if a block is bad.
+ * Side Effects: None.
+ */
+static int32_t collect_runs(uint32_t inode, uint32_t nr_blocks, extent_t *extents) {
+    fs2_inode_t *disk;
+    inode_t *inode_struct;
+    uint32_t nr_extents = 0, end = 0, i, n = 0;
+
+    if (fs_version == FS2_VERSION && fs2_block_lists[inode] == NULL) {
+        disk = fs2_inode(inode);
+        if (disk->nr_extents > FS2_INODE_EXTENTS)
+            return -1;
+        for (i = 0; i < disk->nr_extents; i++) {
+            if (disk->extents[i].start >= nr_image_blocks || disk->extents[i].nr_blocks > nr_image_blocks - disk->extents[i].start ||
+                disk->extents[i].nr_blocks > nr_blocks - n)
+                return -1;
+            add_run(extents, &nr_extents, &end, n, block_addr(disk->extents[i].start), disk->extents[i].nr_blocks);
+            n += disk->extents[i].nr_blocks;
+        }
+        return (n == nr_blocks) ? nr_extents : -1;
+    }
+
+    inode_struct = inode_blocks(inode);
+    for (i = 0; i < nr_blocks; i++) {
+        if (block_addr(inode_struct->inodes[i]) == 0)
+            return -1;
+        add_run(extents, &nr_extents, &end, i, block_addr(inode_struct->inodes[i]), 1);
+    }
+    return nr_extents;
+}
+
+/* check_lz4_table
+ * Description: check the offset table of a compressed file, reads then trust it.
+ * Inputs: map of a compressed file, its extents filled in
+ * Outputs: 0 for success; -1 if the compressed data is not contiguous in memory, or the table is bad.
+ * Side Effects: None.
+ */
+static int32_t check_lz4_table(inode_map_t *map) {
+    uint32_t nr = (map->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t size, i;
+    uint32_t *table;
+
+    if (map->nr_extents != 1)
+        return -1;
+    size = map->extents[0].nr_blocks * BLOCK_SIZE;
+    table = (uint32_t *)map->extents[0].addr;
+    if (nr + 1 > size / sizeof(uint32_t) || table[0] < (nr + 1) * sizeof(uint32_t) || table[nr] > size)
+        return -1;
+    for (i = 0; i < nr; i++) {
+        if (table[i] > table[i + 1])
+            return -1;
+    }
+    return 0;
+}
+
+/* build_inode_map
+ * Description: check the blocks of an inode and merge runs of blocks contiguous in memory into extents.
+ * Inputs: inode number
+ *         the map to fill in.
+ * Outputs: 0 for success; -1 if the inode is bad or out of memory (map->valid stays 0).
+ * Side Effects: the old extents are freed, call it again whenever the block list changes.
+ */
+static int32_t build_inode_map(uint32_t inode, inode_map_t *map) {
+    fs2_inode_t *disk;
+    uint32_t nr_blocks, i;
+    int32_t nr_extents;
+
+    kfree(map->extents);
+    map->valid = 0;
+    map->lz4 = 0;
+    map->nr_extents = 0;
+    map->extents = NULL;
+
+    if (fs_version == FS2_VERSION && fs2_block_lists[inode] == NULL) {
+        disk = fs2_inode(inode);
+        map->length = disk->length;
+        map->lz4 = (boot_block->boot_block_stats.features & FS_FEATURE_LZ4) && (disk->flags & FS2_INODE_LZ4);
+    } else {
+        map->length = inode_blocks(inode)->length;
+        if (map->length > MAX_FILE_SIZE)
+            return -1;
+    }
+    nr_blocks = map->length / BLOCK_SIZE + (map->length % BLOCK_SIZE != 0);
+
+    // the extents of a compressed file hold fewer blocks than its length needs
+    if (map->lz4) {
+        if (disk->nr_extents > FS2_INODE_EXTENTS)
+            return -1;
+        for (i = 0, nr_blocks = 0; i < disk->nr_extents; i++)
+            nr_blocks += disk->extents[i].nr_blocks;
+    }
+
+    nr_extents = collect_runs(inode, nr_blocks, NULL);
+    if (nr_extents == -1)
+        return -1;
+
+    if (nr_extents != 0) {
+        map->extents = kmalloc(nr_extents * sizeof(extent_t));
+        if (map->extents == NULL)
+            return -1;
+    }
+    collect_runs(inode, nr_blocks, map->extents);
+    map->nr_extents = nr_extents;
+
+    if (map->lz4 && -1 == check_lz4_table(map)) {
+        kfree(map->extents);
+        map->extents = NULL;
+        map->nr_extents = 0;
+        return -1;
+    }
+    map->valid = 1;
+    return 0;
+}
+
+/* find_extent
+ * Description: find the extent holding a block of a file.
+ * Inputs: map of a valid inode
+ *         index of the block inside the file, below the file's block count.
+ * Outputs: the extent.
+ * Side Effects: None.
+ */
+static extent_t *find_extent(inode_map_t *map, uint32_t blk) {
+    uint32_t lo = 0, hi = map->nr_extents - 1, mid;
+
+    // extents are sorted by file_block and cover the file without holes
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (map->extents[mid].file_block <= blk)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return &(map->extents[lo]);
+}
+
+/* lz4_block
+ * Description: decompress one block of a compressed file.
+ * Inputs: map of a valid compressed file
+ *         index of the block inside the file, below the file's block count
+ *         where the 4KB block goes.
+ * Outputs: 0 for success; -1 if the compressed data is corrupt.
+ * Side Effects: the bytes past the end of the file are zeroed.
+ */
+static int32_t lz4_block(inode_map_t *map, uint32_t idx, uint8_t *dst) {
+    uint32_t *table = (uint32_t *)map->extents[0].addr;
+    uint8_t *src = (uint8_t *)map->extents[0].addr + table[idx];
+    uint32_t stored = table[idx + 1] - table[idx];
+    uint32_t size = map->length - idx * BLOCK_SIZE;
+
+    if (size > BLOCK_SIZE)
+        size = BLOCK_SIZE;
+    if (stored == size)
+        memcpy(dst, src, size); // did not shrink, stored as is
+    else if ((int32_t)size != lz4_decompress(src, stored, dst, size))
+        return -1;
+    memset(dst + size, 0, BLOCK_SIZE - size);
+    return 0;
+}
+
+/* cached_block
+ * Description: find a block of a compressed file in the block cache, decompressing it on a miss.
+ * Inputs: inode of a valid compressed file
+ *         index of the block inside the file, below the file's block count.
+ * Outputs: address of the decompressed block; 0 if it is corrupt or out of memory.
+ * Side Effects: the block stays valid until the next miss, call it with interrupts off.
+ */
+static uint32_t cached_block(uint32_t inode, uint32_t idx) {
+    uint32_t addr = bcache_lookup(inode, idx);
+
+    if (addr != 0)
+        return addr;
+    addr = bcache_alloc(inode, idx);
+    if (addr != 0 && -1 == lz4_block(&inode_maps[inode], idx, (uint8_t *)addr)) {
+        bcache_invalidate(inode);
+        return 0;
+    }
+    return addr;
+}
+
+/* is_dot
+ * Description: check for the "." and ".." names every directory may list.
+ * Inputs: file name
+ * Outputs: 1 for "." or ".."; 0 otherwise.
+ * Side Effects: None.
+ */
+static int32_t is_dot(const int8_t *name) {
+    return !strncmp(name, ".", FILENAME_MAX_CHAR) || !strncmp(name, "..", FILENAME_MAX_CHAR);
+}
+
+/* dir_of
+ * Description: find the directory an inode holds.
+ * Inputs: inode, FS_ROOT_INODE for the root
+ * Outputs: the directory; NULL if the inode is not a loaded directory.
+ * Side Effects: None.
+ */
+static fs_dir_t *dir_of(uint32_t inode) {
+    if (inode == FS_ROOT_INODE)
+        return &root_dir;
+    if (dirs == NULL || inode >= boot_block->boot_block_stats.num_inodes)
+        return NULL;
+    return dirs[inode];
+}
+
+/* read_dir_entries
+ * Description: copy the entries of a directory out of its data.
+ * Inputs: directory to fill in
+ *         inode of a directory, its map valid.
+ * Outputs: 0 for success; -1 when out of memory.
+ * Side Effects: None.
+ */
+static int32_t read_dir_entries(fs_dir_t *dir, uint32_t inode) {
+    uint32_t nr = inode_maps[inode].length / sizeof(dentry_t);
+
+    dir->entries = kmalloc((nr == 0 ? 1 : nr) * sizeof(dentry_t));
+    if (dir->entries == NULL)
+        return -1;
+    read_data(inode, 0, (int8_t *)dir->entries, nr * sizeof(dentry_t));
+    dir->nr_entries = nr;
+    dir->capacity = (nr == 0) ? 1 : nr;
+    return 0;
+}
+
+/* load_dir
+ * Description: hash the names of a directory and load its subdirectories, depth first.
+ * Inputs: a directory with its entries filled in
+ *         depth of the directory, the root is 0.
+ * Outputs: None.
+ * Side Effects: a subdirectory that is broken, out of memory, too deep or seen before stays unloaded,
+ *               opening it lists nothing and paths through it fail.
+ */
+static void load_dir(fs_dir_t *dir, uint32_t depth) {
+    fs_dir_t *sub;
+    dentry_t *entry;
+    uint32_t i, inode;
+
+    dir->indexed = (0 == dir_index_build(&dir->index, dir->entries, dir->nr_entries));
+    if (!(boot_block->boot_block_stats.features & FS_FEATURE_DIRS) || dirs == NULL || depth >= FS_MAX_DEPTH)
+        return;
+
+    for (i = 0; i < dir->nr_entries; i++) {
+        entry = &(dir->entries[i]);
+        inode = entry->nr_inode;
+        if (entry->type != DIR || is_dot(entry->filename) || inode >= boot_block->boot_block_stats.num_inodes ||
+            !inode_maps[inode].valid || dirs[inode] != NULL)
+            continue;
+
+        sub = kzalloc(sizeof(fs_dir_t));
+        if (sub == NULL || -1 == read_dir_entries(sub, inode)) {
+            kfree(sub);
+            continue;
+        }
+        sub->inode = inode;
+        sub->parent = dir;
+        dirs[inode] = sub;
+        load_dir(sub, depth + 1);
+    }
+}
+
+/* mark_inode
+ * Description: mark an inode and its data blocks used.
+ * Inputs: inode
+ * Outputs: None.
+ * Side Effects: None.
+ */
+static void mark_inode(uint32_t inode) {
+    extent_t *ext;
+    uint32_t i, j;
+
+    if (inode >= boot_block->boot_block_stats.num_inodes)
+        return;
+    BIT_SET(inode_bitmap, inode);
+    if (!inode_maps[inode].valid)
+        return;
+
+    // every block is in the image at mount
+    for (i = 0; i < inode_maps[inode].nr_extents; i++) {
+        ext = &(inode_maps[inode].extents[i]);
+        for (j = 0; j < ext->nr_blocks; j++)
+            BIT_SET(block_bitmap, (ext->addr - data_block_start) / BLOCK_SIZE + j);
+    }
+}
+
+/* build_bitmaps
+ * Description: mark the inodes and data blocks the files and directories of the image use, everything else is free.
+ * Inputs: None
+ * Outputs: 0 for success; -1 when out of memory (nothing can be written then).
+ * Side Effects: None.
+ */
+static int32_t build_bitmaps(void) {
+    uint32_t nr_blocks = nr_image_blocks + FS_EXTRA_BLOCKS;
+    uint32_t i, j;
+    fs_dir_t *dir;
+
+    extra_blocks = kzalloc(FS_EXTRA_BLOCKS * sizeof(uint32_t));
+    block_bitmap = kzalloc((nr_blocks + 31) / 32 * sizeof(uint32_t));
+    inode_bitmap = kzalloc((boot_block->boot_block_stats.num_inodes + 31) / 32 * sizeof(uint32_t) + 1);
+    if (extra_blocks == NULL || block_bitmap == NULL || inode_bitmap == NULL) {
+        kfree(extra_blocks);
+        kfree(block_bitmap);
+        kfree(inode_bitmap);
+        extra_blocks = block_bitmap = inode_bitmap = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < boot_block->boot_block_stats.num_inodes + 1; i++) {
+        dir = (i == 0) ? &root_dir : dir_of(i - 1);
+        if (dir == NULL)
+            continue;
+        mark_inode((dir == &root_dir) ? fs2_root_inode : dir->inode); // out of range for a version 1 root
+        for (j = 0; j < dir->nr_entries; j++) {
+            if (dir->entries[j].type == REGULAR)
+                mark_inode(dir->entries[j].nr_inode);
+        }
+    }
+    return 0;
+}
+
+/* mount_fs1
+ * Description: check a version 1 image: a boot block, 4KB inodes with a block list, then data blocks.
+ * Inputs: start of the image, its size in blocks
+ * Outputs: 0 for success; -1 if the boot block claims more than the image holds.
+ * Side Effects: None.
+ */
+static int32_t mount_fs1(uint32_t image, uint32_t nr_blocks) {
+    boot_block_t *bb = (boot_block_t *)image;
+
+    // bounds come from the boot block, the image must hold every block it claims
+    if (bb->boot_block_stats.num_dir_entries > MAX_FILES ||
+        bb->boot_block_stats.num_inodes >= nr_blocks ||
+        bb->boot_block_stats.num_data_blocks > nr_blocks - 1 - bb->boot_block_stats.num_inodes)
+        return -1;
+
+    boot_block = bb;
+    fs_version = 1;
+    inode_start = image + BLOCK_SIZE; // Start address of inode blocks.
+    data_block_start = inode_start + BLOCK_SIZE * bb->boot_block_stats.num_inodes; // Start address of data blocks.
+    return 0;
+}
+
+/* mount_fs2
+ * Description: check a version 2 image: a superblock, an inode table with extents, then data blocks.
+ * Inputs: start of the image, its size in blocks
+ * Outputs: 0 for success; -1 if the superblock claims more than the image holds, or out of memory.
+ * Side Effects: None.
+ */
+static int32_t mount_fs2(uint32_t image, uint32_t nr_blocks) {
+    fs2_super_t *super = (fs2_super_t *)image;
+    uint32_t inode_blocks_needed;
+
+    if (super->version != FS2_VERSION || super->num_inodes > nr_blocks * (BLOCK_SIZE / FS2_INODE_SIZE) ||
+        super->root_inode >= super->num_inodes)
+        return -1;
+    inode_blocks_needed = (super->num_inodes * FS2_INODE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (super->inode_start == 0 || super->inode_start > nr_blocks || inode_blocks_needed > nr_blocks - super->inode_start ||
+        super->data_start < super->inode_start + inode_blocks_needed || super->data_start > nr_blocks ||
+        super->num_data_blocks > nr_blocks - super->data_start)
+        return -1;
+
+    fs2_block_lists = kzalloc(super->num_inodes * sizeof(inode_t *) + 1);
+    if (fs2_block_lists == NULL)
+        return -1;
+
+    memset(&fs2_stats, 0, sizeof(fs2_stats));
+    fs2_stats.boot_block_stats.num_inodes = super->num_inodes;
+    fs2_stats.boot_block_stats.num_data_blocks = super->num_data_blocks;
+    fs2_stats.boot_block_stats.features = super->features;
+    boot_block = &fs2_stats;
+    fs_version = FS2_VERSION;
+    fs2_root_inode = super->root_inode;
+    inode_start = image + super->inode_start * BLOCK_SIZE;
+    data_block_start = image + super->data_start * BLOCK_SIZE;
+    return 0;
+}
+
 /* fs_init
  * Description: Initialize the filesystem.
  * Inputs: booting information
- * Outputs: None
- * Side Effects: Copy the filesystem to kernel. Calculate several important addresses within the filesystem.
+ * Outputs: 0 for success; -1 if there is no usable image (an empty filesystem is mounted).
+ * Side Effects: Mount the image in place, in the module GRUB loaded (page aligned, so data
+ *               blocks can be mapped into user space). Either image format works, the superblock tells them apart.
  */
-void fs_init(multiboot_info_t *boot_info) {
-    uint32_t fs_start_addr = ((module_t *)(boot_info->mods_addr))->mod_start; 
+int32_t fs_init(multiboot_info_t *boot_info) {
+    module_t *mod = (module_t *)(boot_info->mods_addr);
+    uint32_t nr_blocks, i;
+    int32_t ret = -1;
+
+    fs2_root_inode = FS_ROOT_INODE;
+    bcache_init();
 
-    memcpy((void*)fs_blocks, (void*)fs_start_addr, BLOCK_SIZE * TOTAL_BLOCK); // Copy the filesystem from module space to kernel space.
+    // the image must stay reachable once paging is on: kernel page or direct map
+    if (boot_info->mods_count > 0 && mod->mod_start >= KERNEL_START && mod->mod_end <= DIRECT_MAP_END &&
+        mod->mod_end - mod->mod_start >= BLOCK_SIZE) {
+        nr_blocks = (mod->mod_end - mod->mod_start) / BLOCK_SIZE;
+        if (((fs2_super_t *)mod->mod_start)->magic == FS2_MAGIC)
+            ret = mount_fs2(mod->mod_start, nr_blocks);
+        else
+            ret = mount_fs1(mod->mod_start, nr_blocks);
+    }
+    if (ret == -1)
+        mount_fs1((uint32_t)&empty_fs, 1);
+
+    nr_image_blocks = boot_block->boot_block_stats.num_data_blocks;
+
+    // check the blocks of every inode once, reads then trust the extents
+    inode_maps = kzalloc(boot_block->boot_block_stats.num_inodes * sizeof(inode_map_t) + 1);
+    if (inode_maps == NULL) {
+        mount_fs1((uint32_t)&empty_fs, 1);
+        fs2_root_inode = FS_ROOT_INODE;
+        nr_image_blocks = 0;
+        ret = -1;
+    }
+    for (i = 0; i < boot_block->boot_block_stats.num_inodes; i++)
+        build_inode_map(i, &inode_maps[i]); // a bad inode just fails every read
 
-    boot_block = fs_blocks[0]; // fill in the boot_block struct
+    // hash the names once, open and execute look them up by path all the time
+    root_dir.inode = FS_ROOT_INODE;
+    root_dir.entries = boot_block->files;
+    root_dir.nr_entries = boot_block->boot_block_stats.num_dir_entries;
+    root_dir.capacity = MAX_FILES;
+    root_dir.parent = &root_dir;
+    if (fs_version == FS2_VERSION && (!inode_maps[fs2_root_inode].valid || -1 == read_dir_entries(&root_dir, fs2_root_inode))) {
+        printf("Bad root directory, it is empty\n");
+        root_dir.nr_entries = 0;
+    }
+    dirs = kzalloc(boot_block->boot_block_stats.num_inodes * sizeof(fs_dir_t *) + 1);
+    load_dir(&root_dir, 0);
 
-    // calc addr
-    inode_start = (uint32_t)fs_blocks + BLOCK_SIZE; // Start address of inode blocks.
-    data_block_start = inode_start + BLOCK_SIZE * boot_block.boot_block_stats.num_inodes; // Start address of data blocks.
+    // files can be created and grown, find out which blocks and inodes are free
+    if (-1 == build_bitmaps())
+        printf("Out of memory for the block bitmap, the filesystem is read-only\n");
 
     // populate operation table
     dir_ops.read = (void*)dir_read;
@@ -57,20 +595,22 @@ void fs_init(multiboot_info_t *boot_info) {
     stdout_ops.close = (void*)terminal_close;
     stdout_ops.read = (void*)terminal_read;
     stdout_ops.write = (void*)terminal_write;
+
+    return ret;
 }
 
 /* read_dentry_by_index
  * Description: Fill the dentry with the file info with index .
- * Inputs: index of boot block entries.
+ * Inputs: index of root directory entries.
  *         pointer of a dentry struct.
  * Outputs: status: 0 for success; 1 for fail.
  * Side Effects: None.
  */
 int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry) {
-    if (index < 0 || index >= boot_block.boot_block_stats.num_dir_entries)
+    if (index < 0 || index >= root_dir.nr_entries)
         return -1;
     
-    dentry_t dentry_struct = boot_block.files[index];
+    dentry_t dentry_struct = root_dir.entries[index];
 
     // fill in the filename
     strncpy(dentry->filename, dentry_struct.filename, FILENAME_MAX_CHAR);
@@ -82,32 +622,114 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry) {
     return 0;
 }
 
+/* dir_lookup
+ * Description: find a name in a directory. O(1) through the name hash built at mount.
+ * Inputs: directory
+ *         file name, no '/'.
+ * Outputs: index of the entry; -1 if there is none.
+ * Side Effects: None.
+ */
+static int32_t dir_lookup(fs_dir_t *dir, const int8_t *name) {
+    uint32_t i;
+
+    if (dir->indexed)
+        return dir_index_lookup(&dir->index, dir->entries, name);
+
+    for (i = 0; i < dir->nr_entries; i++) {
+        if (!strncmp(dir->entries[i].filename, name, FILENAME_MAX_CHAR))
+            return i;
+    }
+    return -1;
+}
+
+/* walk_path
+ * Description: follow a path down to the directory holding its last name. Paths start at the root,
+ *              a leading '/' is optional, "." and ".." work as usual.
+ * Inputs: path
+ *         name -- FILENAME_MAX_CHAR + 1 bytes, filled with the last name of the path ("" for the root).
+ * Outputs: the directory holding the last name; NULL if a directory on the way does not exist or a name is too long.
+ * Side Effects: None.
+ */
+static fs_dir_t *walk_path(const int8_t *path, int8_t *name) {
+    fs_dir_t *dir = &root_dir;
+    int32_t len, i;
+
+    name[0] = '\0';
+    for (;;) {
+        while (*path == '/')
+            path++;
+        if (*path == '\0')
+            return dir;
+
+        // another name follows, so the last one has to be a directory
+        if (!strncmp(name, "..", FILENAME_MAX_CHAR)) {
+            dir = dir->parent;
+        } else if (name[0] != '\0' && strncmp(name, ".", FILENAME_MAX_CHAR)) {
+            i = dir_lookup(dir, name);
+            if (i == -1 || dir->entries[i].type != DIR || NULL == (dir = dir_of(dir->entries[i].nr_inode)))
+                return NULL;
+        }
+
+        for (len = 0; path[len] != '\0' && path[len] != '/'; len++)
+            ;
+        if (len > FILENAME_MAX_CHAR)
+            return NULL;
+        memcpy(name, path, len);
+        name[len] = '\0';
+        path += len;
+    }
+}
+
+/* lookup_path
+ * Description: resolve a path to a directory entry.
+ * Inputs: path
+ *         pointer of a dentry struct.
+ * Outputs: 0 for success; -1 if there is no such file.
+ * Side Effects: None.
+ */
+static int32_t lookup_path(const int8_t *path, dentry_t *dentry) {
+    int8_t name[FILENAME_MAX_CHAR + 1];
+    fs_dir_t *dir = walk_path(path, name);
+    int32_t i;
+
+    if (dir == NULL)
+        return -1;
+
+    if (name[0] != '\0' && !is_dot(name)) {
+        i = dir_lookup(dir, name);
+        if (i == -1)
+            return -1;
+        *dentry = dir->entries[i];
+        return 0;
+    }
+
+    // the directory itself
+    if (!strncmp(name, "..", FILENAME_MAX_CHAR))
+        dir = dir->parent;
+    memset(dentry, 0, sizeof(dentry_t));
+    dentry->filename[0] = '.';
+    dentry->type = DIR;
+    dentry->nr_inode = dir->inode;
+    return 0;
+}
+
 /* read_dentry_by_name
- * Description: Fill the dentry with the file info with filename.
- * Inputs: filename
+ * Description: Fill the dentry with the file info with filename. Hot paths come from the dentry cache.
+ * Inputs: path of the file
  *         pointer of a dentry struct.
  * Outputs: status: 0 for success; 1 for fail.
  * Side Effects: None.
  */
 int32_t read_dentry_by_name(const int8_t *fname, dentry_t *dentry) {
-    int i;
-    if(strlen(fname) > 32){
-        // printf("File name too long\n");
-        // printf("Length:     %d\n", strlen(fname));
-        // printf("%s\n", fname);
-        return -1;
-    }
-    // printf("%d\n", strlen(fname));
-    for (i = 0; i < boot_block.boot_block_stats.num_dir_entries; i++) {
-        if (!strncmp(boot_block.files[i].filename, fname, FILENAME_MAX_CHAR)) {
-            // printf("%s\n", fname);
-            read_dentry_by_index(i, dentry);
-            return 0;
-        }
-    }
-    // printf("read fail!\n");
+    if (fname == NULL || fname[0] == '\0' || strlen(fname) >= FS_PATH_MAX)
+        return -1;
 
-    return -1;
+    if (0 == dcache_lookup(fname, dentry))
+        return 0;
+    if (-1 == lookup_path(fname, dentry))
+        return -1;
+    dcache_insert(fname, dentry);
+    return 0;
 }
 
 /* read_data
@@ -116,77 +738,543 @@ int32_t read_dentry_by_name(const int8_t *fname, dentry_t *dentry) {
  *         reading offset
  *         buffer
  *         the length of content to be read.
- * Outputs: positive value for the number of bytes read; -1 for fail.
- * Side Effects: content of the file is filled into the buffer.
+ * Outputs: positive value for the number of bytes read; -1 for fail, or a corrupt compressed block.
+ * Side Effects: content of the file is filled into the buffer, one memcpy per extent, or per block of a compressed file.
  */
 int32_t read_data(uint32_t inode, uint32_t offset, int8_t *buf, uint32_t length) {
     // attention
     // we don't check whether the inode passed corresponds to a file, just check the range
     // we have to trust the `buf` is large enough to hold the data (because we have no idea about the ptr ...)
-    uint32_t i;      // idx of data node
+    inode_map_t *map;
+    extent_t *ext;
     uint32_t end;   // end byte, truncate if needed
-    uint32_t start_blk_idx, end_blk_idx;
-    uint32_t data_blk_ptr;
-    uint32_t start_off, end_off;
+    uint32_t pos;   // next byte to copy
+    uint32_t run;   // bytes left in the current extent
+    uint32_t addr, flags;
 
-    if (inode >= MAX_FILES || inode < 0) {
-        // Check if the inode is out of range 0~63
+    if (inode >= boot_block->boot_block_stats.num_inodes || !inode_maps[inode].valid)
         return -1;
-    }
-    
-    // fetch inode information given inode number
-    inode_t *inode_struct = (inode_t *)(inode * BLOCK_SIZE + inode_start);
-    
+    map = &inode_maps[inode];
 
-    if (inode_struct->length <= offset || offset < 0) {
+    if (offset >= map->length) {
         // Check if the start position of reading is beyond the length of the file.
         return 0;
     }
+    end = (length >= map->length - offset) ? map->length : offset + length;
+
+    if (map->lz4) {
+        // one block at a time through the block cache, another read may reuse the frame once interrupts are back on
+        for (pos = offset; pos < end; pos += run) {
+            run = BLOCK_SIZE - pos % BLOCK_SIZE;
+            if (run > end - pos)
+                run = end - pos;
+            cli_and_save(flags);
+            addr = cached_block(inode, pos / BLOCK_SIZE);
+            if (addr != 0)
+                memcpy(buf, (void*)(addr + pos % BLOCK_SIZE), run);
+            restore_flags(flags);
+            if (addr == 0)
+                return -1;
+            buf += run;
+        }
+        return end - offset;
+    }
+
+    ext = find_extent(map, offset / BLOCK_SIZE);
+    for (pos = offset; pos < end; ext++) {
+        run = (ext->file_block + ext->nr_blocks) * BLOCK_SIZE - pos;
+        if (run > end - pos)
+            run = end - pos;
+        memcpy(buf, (void*)(ext->addr + pos - ext->file_block * BLOCK_SIZE), run);
+        buf += run;
+        pos += run;
+    }
 
-    // each data block is 4 KB (4096 b)
+    return end - offset;
+}
 
-    start_blk_idx = offset / BLOCK_SIZE;   // index inside the inode array
-    if (start_blk_idx >= MAX_FILES)
+/* fs_file_length
+ * Description: size of a file.
+ * Inputs: inode of the file
+ * Outputs: length in bytes; -1 if the inode is bad.
+ * Side Effects: None.
+ */
+int32_t fs_file_length(uint32_t inode) {
+    if (inode >= boot_block->boot_block_stats.num_inodes || !inode_maps[inode].valid)
         return -1;
-    start_off = offset - offset / BLOCK_SIZE * BLOCK_SIZE;
+    return inode_maps[inode].length;
+}
 
-    end = (offset + length >= inode_struct->length ? inode_struct->length : offset + length);
-    
-    end_blk_idx = end / BLOCK_SIZE;        // index inside the inode array
-    if (end_blk_idx >= MAX_FILES)
+/* alloc_block
+ * Description: take a free data block, zero filled. Blocks past the image get a frame from mm.c.
+ * Inputs: goal -- block to try first, the one after the file's last block keeps it contiguous
+ * Outputs: block number; -1 if the filesystem is full or out of memory.
+ * Side Effects: None.
+ */
+static int32_t alloc_block(uint32_t goal) {
+    uint32_t nr_blocks = nr_image_blocks + FS_EXTRA_BLOCKS;
+    uint32_t i, blk, addr;
+
+    for (i = 0; i < nr_blocks; i++) {
+        blk = (goal + i) % nr_blocks;
+        if (BIT_TEST(block_bitmap, blk))
+            continue;
+
+        if (blk >= nr_image_blocks) {
+            addr = alloc_frames(0);
+            if (addr == 0)
+                continue; // out of memory, the image may still have room
+            extra_blocks[blk - nr_image_blocks] = addr;
+        }
+        memset((void*)block_addr(blk), 0, BLOCK_SIZE);
+        BIT_SET(block_bitmap, blk);
+        return blk;
+    }
+    return -1;
+}
+
+/* free_block
+ * Description: give back a data block.
+ * Inputs: block number
+ * Outputs: None.
+ * Side Effects: a block past the image goes back to mm.c.
+ */
+static void free_block(uint32_t blk) {
+    if (blk >= nr_image_blocks) {
+        free_frames(extra_blocks[blk - nr_image_blocks], 0);
+        extra_blocks[blk - nr_image_blocks] = 0;
+    }
+    BIT_CLEAR(block_bitmap, blk);
+}
+
+/* free_extents
+ * Description: give back every data block the extents of a file cover.
+ * Inputs: map of a valid inode whose blocks are all in the image, as at mount
+ * Outputs: None.
+ * Side Effects: None.
+ */
+static void free_extents(inode_map_t *map) {
+    extent_t *ext;
+    uint32_t i, j;
+
+    for (i = 0; i < map->nr_extents; i++) {
+        ext = &(map->extents[i]);
+        for (j = 0; j < ext->nr_blocks; j++)
+            free_block((ext->addr - data_block_start) / BLOCK_SIZE + j);
+    }
+}
+
+/* inflate_inode
+ * Description: decompress a whole compressed file into blocks of its own, a block list in a frame
+ *              tracks them like any file that has changed. Writes and mappings need this.
+ * Inputs: inode of a valid compressed file
+ * Outputs: 0 for success; -1 if the file is too big for a block list, out of space or memory,
+ *          or corrupt (nothing changes).
+ * Side Effects: the compressed blocks are freed and the block cache forgets the file.
+ */
+static int32_t inflate_inode(uint32_t inode) {
+    inode_map_t *map = &inode_maps[inode];
+    uint32_t nr = (map->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    inode_t *list;
+    uint32_t i;
+    int32_t blk;
+
+    if (map->length > MAX_FILE_SIZE || block_bitmap == NULL)
+        return -1;
+    list = (inode_t *)alloc_frames(0);
+    if (list == NULL)
         return -1;
-    end_off = end - end / BLOCK_SIZE * BLOCK_SIZE;
 
-    // Check if a bad data block number is found within the file bounds of the given inode
-    int j;
-    for (j = start_blk_idx; j <= end_blk_idx; j++){
-        if (inode_struct->inodes[j] >= boot_block.boot_block_stats.num_data_blocks) {
+    for (i = 0; i < nr; i++) {
+        blk = alloc_block((i == 0) ? 0 : list->inodes[i - 1] + 1);
+        if (blk != -1 && -1 == lz4_block(map, i, (uint8_t *)block_addr(blk))) {
+            free_block(blk);
+            blk = -1;
+        }
+        if (blk == -1) {
+            while (i > 0)
+                free_block(list->inodes[--i]);
+            free_frames((uint32_t)list, 0);
             return -1;
         }
+        list->inodes[i] = blk;
     }
-    
-    // Start
-    data_blk_ptr = inode_struct->inodes[start_blk_idx] * BLOCK_SIZE + data_block_start;
-    if (end_blk_idx != start_blk_idx) {
-        memcpy(buf, (void*)(data_blk_ptr + start_off), BLOCK_SIZE - start_off);
-        buf += BLOCK_SIZE - start_off;
-    } else {
-        memcpy(buf, (void*)(data_blk_ptr + start_off), end_off - start_off);
+
+    free_extents(map);
+    bcache_invalidate(inode);
+    list->length = map->length;
+    fs2_block_lists[inode] = list;
+    fs2_inode(inode)->flags &= ~FS2_INODE_LZ4;
+    return build_inode_map(inode, map);
+}
+
+/* fs_block_addr
+ * Description: find where a block of a file lives in memory, so it can be mapped instead of copied.
+ * Inputs: inode of the file
+ *         index of the block inside the file.
+ * Outputs: address of the 4KB data block; 0 if the block is past the end of the file or bad,
+ *          or a compressed file could not be decompressed.
+ * Side Effects: a compressed file is decompressed into blocks of its own first, a mapping needs them to stay put.
+ */
+uint32_t fs_block_addr(uint32_t inode, uint32_t idx) {
+    extent_t *ext;
+    uint32_t flags;
+    int32_t ret;
+
+    if (inode >= boot_block->boot_block_stats.num_inodes || !inode_maps[inode].valid)
+        return 0;
+    if (idx >= (inode_maps[inode].length + BLOCK_SIZE - 1) / BLOCK_SIZE)
+        return 0;
+    if (inode_maps[inode].lz4) {
+        cli_and_save(flags);
+        ret = inflate_inode(inode);
+        restore_flags(flags);
+        if (ret == -1)
+            return 0;
+    }
+
+    ext = find_extent(&inode_maps[inode], idx);
+    return ext->addr + (idx - ext->file_block) * BLOCK_SIZE;
+}
+
+/* resize_inode
+ * Description: grow or shrink a file, new bytes read as zeros.
+ * Inputs: inode of a valid file
+ *         new length.
+ * Outputs: 0 for success; -1 if it does not fit (nothing changes), or the file is mapped and would shrink.
+ * Side Effects: blocks are allocated or freed, the extent map is rebuilt when the block list changes.
+ */
+static int32_t resize_inode(uint32_t inode, uint32_t length) {
+    inode_map_t *map = &inode_maps[inode];
+    inode_t *inode_struct;
+    uint32_t old_nr = (map->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t new_nr = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t nr;
+    int32_t blk;
+
+    if (map->lz4 && -1 == inflate_inode(inode))
+        return -1;
+    inode_struct = inode_blocks(inode);
+    if (inode_struct == NULL || length > MAX_FILE_SIZE || (length < map->length && map->nr_maps > 0))
+        return -1;
+
+    // a shrink may have left old bytes after the end of the last block
+    if (length > map->length && map->length % BLOCK_SIZE != 0)
+        memset((void*)(fs_block_addr(inode, map->length / BLOCK_SIZE) + map->length % BLOCK_SIZE), 0,
+               BLOCK_SIZE - map->length % BLOCK_SIZE);
+
+    for (nr = old_nr; nr < new_nr; nr++) {
+        blk = alloc_block((nr == 0) ? 0 : inode_struct->inodes[nr - 1] + 1);
+        if (blk == -1) {
+            while (nr > old_nr)
+                free_block(inode_struct->inodes[--nr]);
+            return -1;
+        }
+        inode_struct->inodes[nr] = blk;
     }
+    for (nr = old_nr; nr > new_nr; nr--)
+        free_block(inode_struct->inodes[nr - 1]);
 
-    for (i = start_blk_idx + 1; i < end_blk_idx; i++) {
-        data_blk_ptr = inode_struct->inodes[i] * BLOCK_SIZE + data_block_start;
-        memcpy(buf, (void*)data_blk_ptr, BLOCK_SIZE);
-        buf += BLOCK_SIZE;
+    inode_struct->length = length;
+    if (old_nr == new_nr) {
+        map->length = length;
+        return 0;
     }
+    return build_inode_map(inode, map);
+}
 
-    // End
-    if (start_blk_idx != end_blk_idx) {
-        data_blk_ptr = inode_struct->inodes[end_blk_idx] * BLOCK_SIZE + data_block_start;
-        memcpy(buf, (void*)data_blk_ptr, end_off);
+/* free_inode
+ * Description: free the blocks of an unlinked file, and the inode.
+ * Inputs: inode
+ * Outputs: None.
+ * Side Effects: a version 2 inode that never changed is emptied in the image too.
+ */
+static void free_inode(uint32_t inode) {
+    if (inode_maps[inode].valid && fs_version == FS2_VERSION && fs2_block_lists[inode] == NULL) {
+        // still as in the image: no need to decompress what goes away, and a file
+        // longer than MAX_FILE_SIZE has no block list for resize_inode to shrink
+        free_extents(&inode_maps[inode]);
+        bcache_invalidate(inode);
+        fs2_inode(inode)->length = 0;
+        fs2_inode(inode)->nr_extents = 0;
+        fs2_inode(inode)->flags = 0;
+        build_inode_map(inode, &inode_maps[inode]);
+    } else if (inode_maps[inode].valid) {
+        resize_inode(inode, 0);
     }
+    inode_maps[inode].unlinked = 0;
+    BIT_CLEAR(inode_bitmap, inode);
+}
 
-    return end - offset;
+/* write_data
+ * Description: write content of file with inode, growing the file if the write goes past its end.
+ * Inputs: inode of the file
+ *         writing offset
+ *         buffer
+ *         the length of content to be written.
+ * Outputs: number of bytes written; -1 for fail (bad inode, no space, or a process runs the file).
+ * Side Effects: the image cache forgets the file, one memcpy per extent.
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const int8_t *buf, uint32_t length) {
+    inode_map_t *map;
+    extent_t *ext;
+    uint32_t end, pos, run;
+    uint32_t flags;
+    int32_t ret = -1;
+
+    if (inode >= boot_block->boot_block_stats.num_inodes || !inode_maps[inode].valid || block_bitmap == NULL)
+        return -1;
+    map = &inode_maps[inode];
+
+    if (length == 0)
+        return 0;
+    if (offset >= MAX_FILE_SIZE)
+        return -1;
+    end = (length >= MAX_FILE_SIZE - offset) ? MAX_FILE_SIZE : offset + length;
+
+    cli_and_save(flags);
+    if (-1 == image_cache_invalidate(inode)) // text busy
+        goto out;
+    if (map->lz4 && -1 == inflate_inode(inode))
+        goto out;
+    if (end > map->length && -1 == resize_inode(inode, end))
+        goto out;
+
+    ext = find_extent(map, offset / BLOCK_SIZE);
+    for (pos = offset; pos < end; ext++) {
+        run = (ext->file_block + ext->nr_blocks) * BLOCK_SIZE - pos;
+        if (run > end - pos)
+            run = end - pos;
+        memcpy((void*)(ext->addr + pos - ext->file_block * BLOCK_SIZE), buf, run);
+        buf += run;
+        pos += run;
+    }
+    ret = end - offset;
+
+out:
+    restore_flags(flags);
+    return ret;
+}
+
+/* set_nr_entries
+ * Description: set how many entries a directory has, a version 1 root's count also lives in the boot block.
+ * Inputs: directory
+ *         number of entries.
+ * Outputs: None.
+ * Side Effects: None.
+ */
+static void set_nr_entries(fs_dir_t *dir, uint32_t nr) {
+    dir->nr_entries = nr;
+    if (dir->entries == boot_block->files)
+        boot_block->boot_block_stats.num_dir_entries = nr;
+}
+
+/* grow_dir
+ * Description: make room for more entries in a directory, a version 1 root is fixed at MAX_FILES.
+ * Inputs: a full directory
+ * Outputs: 0 for success; -1 for a version 1 root, or out of memory.
+ * Side Effects: the entries move, the name hash keeps indices so it stays valid.
+ */
+static int32_t grow_dir(fs_dir_t *dir) {
+    dentry_t *entries;
+
+    if (dir->entries == boot_block->files)
+        return -1;
+    entries = kmalloc(dir->capacity * 2 * sizeof(dentry_t));
+    if (entries == NULL)
+        return -1;
+    memcpy(entries, dir->entries, dir->nr_entries * sizeof(dentry_t));
+    kfree(dir->entries);
+    dir->entries = entries;
+    dir->capacity *= 2;
+    return 0;
+}
+
+/* fs_create
+ * Description: create an empty regular file.
+ * Inputs: path of the file, its directory must exist
+ * Outputs: 0 for success; -1 if the name is bad or taken, or there is no free entry or inode.
+ * Side Effects: None.
+ */
+int32_t fs_create(const int8_t *fname) {
+    int8_t name[FILENAME_MAX_CHAR + 1];
+    fs_dir_t *dir;
+    dentry_t *dentry;
+    uint32_t inode, i;
+    uint32_t flags;
+    int32_t ret = -1;
+
+    if (fname == NULL || strlen(fname) >= FS_PATH_MAX || inode_bitmap == NULL)
+        return -1;
+
+    cli_and_save(flags);
+    dir = walk_path(fname, name);
+    if (dir == NULL || name[0] == '\0' || is_dot(name) || dir_lookup(dir, name) != -1)
+        goto out;
+    if (dir->nr_entries == dir->capacity && -1 == grow_dir(dir))
+        goto out;
+
+    for (inode = 0; inode < boot_block->boot_block_stats.num_inodes; inode++) {
+        if (!BIT_TEST(inode_bitmap, inode))
+            break;
+    }
+    if (inode == boot_block->boot_block_stats.num_inodes)
+        goto out;
+
+    // an inode no file owned may hold anything, start it empty
+    if (fs_version == FS2_VERSION && fs2_block_lists[inode] == NULL) {
+        fs2_inode(inode)->length = 0;
+        fs2_inode(inode)->nr_extents = 0;
+        fs2_inode(inode)->flags = 0;
+    }
+    if (NULL == inode_blocks(inode))
+        goto out;
+    inode_blocks(inode)->length = 0;
+    if (-1 == build_inode_map(inode, &inode_maps[inode]))
+        goto out;
+    inode_maps[inode].nr_refs = 0;
+    inode_maps[inode].nr_maps = 0;
+    inode_maps[inode].unlinked = 0;
+
+    i = dir->nr_entries;
+    dentry = &(dir->entries[i]);
+    memset(dentry, 0, sizeof(dentry_t));
+    strncpy(dentry->filename, name, FILENAME_MAX_CHAR);
+    dentry->type = REGULAR;
+    dentry->nr_inode = inode;
+    if (dir->indexed && -1 == dir_index_add(&dir->index, dir->entries, i)) {
+        memset(dentry, 0, sizeof(dentry_t));
+        goto out;
+    }
+
+    set_nr_entries(dir, i + 1);
+    BIT_SET(inode_bitmap, inode);
+    ret = 0;
+
+out:
+    restore_flags(flags);
+    return ret;
+}
+
+/* fs_unlink
+ * Description: remove a regular file. Its blocks are freed once nobody has it open or mapped.
+ * Inputs: path of the file
+ * Outputs: 0 for success; -1 if there is no such regular file, or a process runs it.
+ * Side Effects: the last entry of the directory moves into the hole, the dentry cache is flushed.
+ */
+int32_t fs_unlink(const int8_t *fname) {
+    int8_t name[FILENAME_MAX_CHAR + 1];
+    fs_dir_t *dir;
+    int32_t i, last;
+    uint32_t inode;
+    uint32_t flags;
+    int32_t ret = -1;
+
+    if (fname == NULL || strlen(fname) >= FS_PATH_MAX || inode_bitmap == NULL)
+        return -1;
+
+    cli_and_save(flags);
+    dir = walk_path(fname, name);
+    if (dir == NULL || name[0] == '\0')
+        goto out;
+    i = dir_lookup(dir, name);
+    if (i == -1 || dir->entries[i].type != REGULAR)
+        goto out;
+    inode = dir->entries[i].nr_inode;
+    if (-1 == image_cache_invalidate(inode)) // text busy
+        goto out;
+
+    last = dir->nr_entries - 1;
+    if (dir->indexed) {
+        dir_index_remove(&dir->index, dir->entries, i);
+        if (i != last)
+            dir_index_remove(&dir->index, dir->entries, last);
+    }
+    if (i != last)
+        dir->entries[i] = dir->entries[last];
+    memset(&(dir->entries[last]), 0, sizeof(dentry_t));
+    set_nr_entries(dir, last);
+    if (dir->indexed && i != last)
+        dir_index_add(&dir->index, dir->entries, i); // fewer entries than before, cannot fail
+    dcache_flush(); // the cached path would now name whatever reuses the inode
+
+    if (inode < boot_block->boot_block_stats.num_inodes) {
+        if (inode_maps[inode].nr_refs > 0)
+            inode_maps[inode].unlinked = 1;
+        else
+            free_inode(inode);
+    }
+    ret = 0;
+
+out:
+    restore_flags(flags);
+    return ret;
+}
+
+/* fs_truncate
+ * Description: set the length of a regular file, new bytes read as zeros.
+ * Inputs: path of the file
+ *         new length.
+ * Outputs: 0 for success; -1 if there is no such file, no space, the file is mapped and would shrink, or a process runs it.
+ * Side Effects: None.
+ */
+int32_t fs_truncate(const int8_t *fname, uint32_t length) {
+    dentry_t dentry;
+    uint32_t flags;
+    int32_t ret = -1;
+
+    if (block_bitmap == NULL)
+        return -1;
+
+    cli_and_save(flags);
+    if (-1 == read_dentry_by_name(fname, &dentry) || dentry.type != REGULAR)
+        goto out;
+    if (dentry.nr_inode >= boot_block->boot_block_stats.num_inodes || !inode_maps[dentry.nr_inode].valid)
+        goto out;
+    if (-1 == image_cache_invalidate(dentry.nr_inode)) // text busy
+        goto out;
+    ret = resize_inode(dentry.nr_inode, length);
+
+out:
+    restore_flags(flags);
+    return ret;
+}
+
+/* fs_inode_get
+ * Description: an open file descriptor or a mapping starts using an inode.
+ * Inputs: inode
+ *         map -- 1 for a mapping, the file cannot shrink while it is mapped.
+ * Outputs: None.
+ * Side Effects: None.
+ */
+void fs_inode_get(uint32_t inode, int32_t map) {
+    if (inode >= boot_block->boot_block_stats.num_inodes)
+        return;
+    inode_maps[inode].nr_refs++;
+    if (map)
+        inode_maps[inode].nr_maps++;
+}
+
+/* fs_inode_put
+ * Description: drop a reference from fs_inode_get.
+ * Inputs: inode
+ *         map -- as passed to fs_inode_get.
+ * Outputs: None.
+ * Side Effects: an unlinked file is freed with its last reference.
+ */
+void fs_inode_put(uint32_t inode, int32_t map) {
+    uint32_t flags;
+
+    if (inode >= boot_block->boot_block_stats.num_inodes || inode_maps[inode].nr_refs == 0)
+        return;
+
+    cli_and_save(flags);
+    inode_maps[inode].nr_refs--;
+    if (map)
+        inode_maps[inode].nr_maps--;
+    if (inode_maps[inode].nr_refs == 0 && inode_maps[inode].unlinked)
+        free_inode(inode);
+    restore_flags(flags);
 }
 
 /* file_open
@@ -206,6 +1294,7 @@ file_entry file_open(const int8_t *fname){
     fde.inode = dentry.nr_inode; // The inode number for this file.
     fde.file_pos = 0; // Keep track of where the user is currently reading from in the file.
     fde.flags = IN_USE;
+    fs_inode_get(fde.inode, 0); // dropped by file_close, an unlinked file lives until then
     return fde;
 }
 
@@ -263,17 +1352,19 @@ int32_t dir_read(file_entry* fp, int8_t* buf, uint32_t length){
     // buf contains 80 chars
     // printf("enter dir***************\n");
     dentry_t dentry;
+    fs_dir_t *dir;
     uint32_t num_read;
     uint32_t index;
     // uint32_t file_size;
     uint32_t i;
     
-    index = fp->file_pos;   // data block in directory is just the boot block (with some proper offset).
-    if (index >= boot_block.boot_block_stats.num_dir_entries) {
+    dir = dir_of(fp->inode);
+    index = fp->file_pos;   // index into the entries of the directory.
+    if (dir == NULL || index >= dir->nr_entries) {
         // printf("Directory read is out of range!");
         return 0;
     }
-    read_dentry_by_index(index, &dentry);
+    dentry = dir->entries[index];
     // printf("buf addr:%x\n", buf);
     memset(buf, '\0', 33);
 
@@ -312,16 +1403,151 @@ int32_t dir_read(file_entry* fp, int8_t* buf, uint32_t length){
     return i;
 }
 
+/* dir_getdents
+ * Description: read many entries of the directory at once, with their type, inode and size.
+ * Inputs: pointer of directory file descriptor entry
+ *         buffer of records
+ *         size of the buffer in bytes.
+ * Outputs: number of bytes filled, a multiple of sizeof(dirent_t); 0 at the end; -1 if not even one record fits.
+ * Side Effects: the file position moves past the entries read, dir_read and getdents share it.
+ */
+int32_t dir_getdents(file_entry* fp, dirent_t* buf, uint32_t nbytes) {
+    fs_dir_t *dir = dir_of(fp->inode);
+    dentry_t *dentry;
+    fs_dir_t *sub;
+    uint32_t nr = 0;
+
+    if (nbytes < sizeof(dirent_t))
+        return -1;
+    if (dir == NULL)
+        return 0;
+
+    while (fp->file_pos < dir->nr_entries && nr < nbytes / sizeof(dirent_t)) {
+        dentry = &(dir->entries[fp->file_pos]);
+        memset(&buf[nr], 0, sizeof(dirent_t));
+        strncpy(buf[nr].name, dentry->filename, FILENAME_MAX_CHAR);
+        buf[nr].type = dentry->type;
+        buf[nr].inode = dentry->nr_inode;
+        if (dentry->type == REGULAR) {
+            buf[nr].length = fs_file_length(dentry->nr_inode);
+            if (buf[nr].length == (uint32_t)-1)
+                buf[nr].length = 0; // a broken inode, reads of it fail
+        } else if (dentry->type == DIR) {
+            if (!strncmp(dentry->filename, ".", FILENAME_MAX_CHAR))
+                sub = dir;
+            else if (!strncmp(dentry->filename, "..", FILENAME_MAX_CHAR))
+                sub = dir->parent;
+            else
+                sub = dir_of(dentry->nr_inode);
+            buf[nr].length = (sub == NULL) ? 0 : sub->nr_entries * sizeof(dentry_t);
+        }
+        fp->file_pos++;
+        nr++;
+    }
+    return nr * sizeof(dirent_t);
+}
+
+/* fs_fstat
+ * Description: report the type, inode and size of an open file.
+ * Inputs: pointer of file descriptor entry of a regular file, directory or rtc
+ *         stat to fill in.
+ * Outputs: 0 for success; -1 for the terminal, or a broken inode.
+ * Side Effects: None.
+ */
+int32_t fs_fstat(file_entry* fp, fs_stat_t* st) {
+    fs_dir_t *dir;
+    int32_t length;
+
+    st->inode = fp->inode;
+    if (fp->op_ptr == (uint32_t)&regular_file_ops) {
+        length = fs_file_length(fp->inode);
+        if (length == -1)
+            return -1;
+        st->type = REGULAR;
+        st->length = length;
+    } else if (fp->op_ptr == (uint32_t)&dir_ops) {
+        dir = dir_of(fp->inode);
+        st->type = DIR;
+        st->length = (dir == NULL) ? 0 : dir->nr_entries * sizeof(dentry_t);
+    } else if (fp->op_ptr == (uint32_t)&rtc_ops) {
+        st->type = USER_RTC;
+        st->length = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* fs_lseek
+ * Description: move the position of an open regular file. Seeking past the end is fine, a write there
+ *              fills the gap with zeros.
+ * Inputs: pointer of regular file descriptor entry
+ *         offset
+ *         whence -- SEEK_SET, SEEK_CUR or SEEK_END.
+ * Outputs: the new position; -1 if it would be negative or past MAX_FILE_SIZE (or the end of a longer file),
+ *          or the file is not regular.
+ * Side Effects: None.
+ */
+int32_t fs_lseek(file_entry* fp, int32_t offset, int32_t whence) {
+    int32_t base, limit;
+
+    if (fp->op_ptr != (uint32_t)&regular_file_ops)
+        return -1;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = fp->file_pos;
+        break;
+    case SEEK_END:
+        base = fs_file_length(fp->inode);
+        if (base == -1)
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    // a version 2 file may be longer than MAX_FILE_SIZE, it can still be read anywhere
+    limit = fs_file_length(fp->inode);
+    if (limit < MAX_FILE_SIZE)
+        limit = MAX_FILE_SIZE;
+    if (offset < -base || offset > limit - base)
+        return -1;
+    fp->file_pos = base + offset;
+    return fp->file_pos;
+}
+
+/* fs_pread
+ * Description: read an open regular file at an offset, without using or moving its position.
+ * Inputs: pointer of regular file descriptor entry
+ *         buffer
+ *         length of content to be read
+ *         offset in the file.
+ * Outputs: number of bytes read, 0 at or past the end of the file; -1 for fail.
+ * Side Effects: None.
+ */
+int32_t fs_pread(file_entry* fp, int8_t* buf, uint32_t length, uint32_t offset) {
+    if (fp->op_ptr != (uint32_t)&regular_file_ops)
+        return -1;
+    return read_data(fp->inode, offset, buf, length);
+}
+
 /* file_write
- * Description: Not been implemented, since it is a read-only filesystem. (Write a regular file with according file descriptor entry.)
+ * Description: Write a regular file with according file descriptor entry, at the current position.
  * Inputs: pointer of regular file descriptor entry
  *         buffer
  *         length of content to be written.
- * Outputs: -1
- * Side Effects: NONE.
+ * Outputs: number of bytes written; -1 for fail.
+ * Side Effects: file position moves past the bytes written.
  */
 int32_t file_write(file_entry* fp, int8_t* buf, uint32_t length) {
-    return -1;
+    int32_t ret = write_data(fp->inode, fp->file_pos, buf, length);
+    if (ret > 0)
+        fp->file_pos += ret;
+    return ret;
 }
 
 /* file_write
@@ -343,6 +1569,7 @@ int32_t dir_write(file_entry* fp, int8_t* buf, uint32_t length) {
  * Side Effects: NONE.
  */
 int32_t file_close(file_entry* fp) {
+    fs_inode_put(fp->inode, 0);
     return 0;
 }
 
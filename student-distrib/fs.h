@@ -8,10 +8,13 @@
 #define MAX_FILES 63
 #define FILENAME_MAX_CHAR 32    /* NOTE: since filename not necessarily includes a terminal EOS, we may truncate characters that exceeds the limit */
 #define DIR_ENTRY_RESERVED_BYTE 24
-#define BOOT_STAT_RESERVED_BYTE 52
+#define BOOT_STAT_RESERVED_BYTE 48
 #define MAX_INODES_PER_FILE 1023
 #define MAX_FILE_SIZE (1023 * 4 * 1024)   /* 4MB - 4KB */
-#define TOTAL_BLOCK (1 + 64 + 59)
+#define FS_EXTRA_BLOCKS 4096    /* data blocks files can grow into after boot (16MB), frames from mm.c */
+#define FS_PATH_MAX 128         /* longest path, '/' separated, including EOS */
+#define FS_MAX_DEPTH 16         /* deepest directory loaded at mount */
+#define FS_ROOT_INODE 0xFFFFFFFF /* inode of the root directory, it lives in the boot block */
 #define SCREEN_WIDTH 80
 #define OFFSET_1 7 //used for formatted terminal output
 
@@ -22,6 +25,28 @@
 #define DIR 1
 #define REGULAR 2
 
+/* fs_stats.features */
+#define FS_FEATURE_DIRS 0x1     /* a DIR entry other than "." or ".." is a subdirectory, its data an array of dentry_t */
+#define FS_FEATURE_LZ4 0x2      /* version 2 only, inodes with FS2_INODE_LZ4 set are compressed */
+
+/* version 2 images: a superblock, a table of FS2_INODE_SIZE byte inodes holding extents, then the data
+ * blocks. The root is a directory inode like any other, so it is not limited to MAX_FILES entries.
+ * Version 1 images (a boot block, 4KB inodes with a block list) still mount, see mkfs/ for the builder. */
+#define FS2_MAGIC 0x46313933    /* "391F", never a valid version 1 entry count */
+#define FS2_VERSION 2
+#define FS2_INODE_SIZE 256
+#define FS2_INODE_EXTENTS 31
+
+/* fs2_inode.flags. The extents of a compressed file hold a table of nr + 1 offsets, nr the blocks of
+ * the file, then block i as LZ4 block format data from offset i to offset i + 1, offsets counted from
+ * the start of the table. A block that did not shrink is stored as is, its size tells them apart. */
+#define FS2_INODE_LZ4 0x1
+
+/* lseek whence */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
 /* file descriptor table entry flag */
 #define OERROR 0
 #define IN_USE 1
@@ -31,13 +56,14 @@ typedef struct fs_stats {
     uint32_t num_dir_entries;   /* should in range 0 - 63 */
     uint32_t num_inodes;
     uint32_t num_data_blocks;
+    uint32_t features;          /* 0 in images without subdirectories */
     int8_t reserved[BOOT_STAT_RESERVED_BYTE];
 }fs_stats_t;
 
 typedef struct dir_entry {
     int8_t filename[FILENAME_MAX_CHAR];
     uint32_t type;
-    uint32_t nr_inode;   /* valid ONLY regular file */
+    uint32_t nr_inode;   /* valid ONLY regular file, and subdirectory */
     int8_t reserved[DIR_ENTRY_RESERVED_BYTE];
 }dentry_t;
 
@@ -46,11 +72,68 @@ typedef struct boot_block {
     dentry_t files[MAX_FILES];
 }boot_block_t;
 
+typedef struct fs2_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t features;          /* FS_FEATURE_DIRS */
+    uint32_t num_inodes;
+    uint32_t num_data_blocks;
+    uint32_t inode_start;       /* first block of the inode table */
+    uint32_t data_start;        /* block of data block 0 */
+    uint32_t root_inode;
+}fs2_super_t;
+
+/* nr_blocks data blocks from start on, in file order */
+typedef struct fs2_extent {
+    uint32_t start;
+    uint32_t nr_blocks;
+}fs2_extent_t;
+
+typedef struct fs2_inode {
+    uint32_t length;            /* file size in bytes, may pass MAX_FILE_SIZE (such a file cannot grow) */
+    uint16_t nr_extents;
+    uint16_t flags;             /* FS2_INODE_LZ4 */
+    fs2_extent_t extents[FS2_INODE_EXTENTS];
+}fs2_inode_t;
+
 typedef struct inode {
     uint32_t length;   /* file size in bytes */
     uint32_t inodes[MAX_INODES_PER_FILE];  /* data blocks (check validity before read!) */
 }inode_t;
 
+/* runs of data blocks of a file contiguous in memory, built at mount */
+typedef struct extent {
+    uint32_t file_block;   /* first block of the run inside the file */
+    uint32_t addr;         /* and where it is in memory */
+    uint32_t nr_blocks;
+}extent_t;
+
+typedef struct inode_map {
+    uint32_t length;       /* file size in bytes */
+    uint32_t nr_extents;   /* 0 for an empty file */
+    extent_t *extents;     /* sorted by file_block, no holes */
+    uint32_t valid;        /* 0 if the inode points past the data blocks */
+    uint32_t nr_refs;      /* open file descriptors and mappings */
+    uint32_t nr_maps;      /* mappings, the blocks must not go away under them */
+    uint32_t unlinked;     /* freed when the last reference goes */
+    uint32_t lz4;          /* compressed, the extents hold the compressed data and reads go through bcache.c */
+}inode_map_t;
+
+/* one fixed size record of getdents */
+typedef struct dirent {
+    int8_t name[FILENAME_MAX_CHAR + 4];   /* EOS terminated, padded to 4 bytes */
+    uint32_t type;
+    uint32_t inode;
+    uint32_t length;   /* bytes, 0 for the rtc */
+}dirent_t;
+
+/* what fstat reports */
+typedef struct fs_stat {
+    uint32_t type;
+    uint32_t inode;    /* FS_ROOT_INODE for the root directory */
+    uint32_t length;   /* bytes, 0 for the rtc */
+}fs_stat_t;
+
 typedef struct file_entry {
     uint32_t op_ptr;
     uint32_t inode;
@@ -87,26 +170,43 @@ typedef struct file_ops {
 } file_ops_t;
 
 /* global variables */
-extern boot_block_t boot_block;
+extern boot_block_t *boot_block;
 // extern boot_block_t *fs_start_addr;
 extern dir_ops_t dir_ops;
 extern regular_file_ops_t regular_file_ops;
 extern rtc_ops_t rtc_ops;
-extern boot_block_t fs_blocks[TOTAL_BLOCK];
 extern uint32_t data_block_start;
 extern uint32_t inode_start;
 extern file_ops_t stdin_ops;
 extern file_ops_t stdout_ops;
 
-/* -1 on failure, non-existing file. 0 on success*/
+/* -1 on failure, non-existing file. 0 on success. fname is a path from the root, '/' separated */
 int32_t read_dentry_by_name(const int8_t *fname, dentry_t *dentry);
 
-/* -1 on failure, invalid index. 0 on success*/
+/* -1 on failure, invalid index. 0 on success. index into the root directory */
 int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry);
 
 /* return number of bytes read and placed in the buffer, 0 means EOF */
 int32_t read_data(uint32_t inode, uint32_t offset, int8_t *buf, uint32_t length);
 
+/* file size in bytes, -1 for a bad inode */
+int32_t fs_file_length(uint32_t inode);
+
+/* address of a data block of a file, 0 past the end of the file */
+uint32_t fs_block_addr(uint32_t inode, uint32_t idx);
+
+/* return number of bytes written, the file grows past its end. -1 on failure */
+int32_t write_data(uint32_t inode, uint32_t offset, const int8_t *buf, uint32_t length);
+
+/* the filesystem lives in RAM, none of these reach the boot module's source. -1 on failure, 0 on success */
+int32_t fs_create(const int8_t *fname);
+int32_t fs_unlink(const int8_t *fname);
+int32_t fs_truncate(const int8_t *fname, uint32_t length);
+
+/* open descriptors and mappings of a file, map is 1 for a mapping */
+void fs_inode_get(uint32_t inode, int32_t map);
+void fs_inode_put(uint32_t inode, int32_t map);
+
 /* file operations */
 
 /* init file temp structures, return 0 */
@@ -128,8 +228,16 @@ int32_t dir_write(file_entry* fp, int8_t* buf, uint32_t length);
 
 int32_t dir_read(file_entry* fp, int8_t* buf, uint32_t length);
 
-/* init the file system */
-void fs_init(multiboot_info_t *boot_info);
+/* fill buf with as many whole records as fit, return bytes filled, 0 at the end, -1 if not even one fits */
+int32_t dir_getdents(file_entry* fp, dirent_t* buf, uint32_t nbytes);
+
+/* random access, for any open file, directory or rtc. -1 on failure */
+int32_t fs_fstat(file_entry* fp, fs_stat_t* st);
+int32_t fs_lseek(file_entry* fp, int32_t offset, int32_t whence);
+int32_t fs_pread(file_entry* fp, int8_t* buf, uint32_t length, uint32_t offset);
+
+/* mount the file system in the boot module, -1 if there is no usable image */
+int32_t fs_init(multiboot_info_t *boot_info);
 
 #endif  /* fs.h */
 
@@ -0,0 +1,187 @@
+#include "image.h"
+#include "kmalloc.h"
+#include "mm.h"
+#include "fs.h"
+#include "lib.h"
+
+static image_t *image_cache = NULL; // every image loaded since boot, a handful of programs
+
+/*
+ * image_free_pages
+ * Description: drop the cache's reference to every page read so far
+ *  Inputs: image
+ *  Outputs: number of pages dropped
+ * Side Effects: frames still mapped by some process live on until it unmaps them.
+ */
+static uint32_t image_free_pages(image_t *image)
+{
+    uint32_t i;
+    uint32_t count = 0;
+
+    for (i = 0; i < image->nr_pages; i++)
+    {
+        if (image->frames[i] != 0)
+        {
+            frame_put(image->frames[i]);
+            image->frames[i] = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * image_get
+ * Description: look an executable up in the cache, add it if it is not there
+ *  Inputs: inode of the program file
+ *  Outputs: the image, NULL when out of memory
+ * Side Effects: None.
+ */
+image_t *image_get(uint32_t inode)
+{
+    image_t *image;
+    int32_t length;
+
+    for (image = image_cache; image != NULL; image = image->next)
+    {
+        if (image->inode == inode)
+        {
+            image->users++;
+            return image;
+        }
+    }
+
+    length = fs_file_length(inode);
+    if (length == -1)
+        return NULL;
+
+    image = kmalloc(sizeof(image_t));
+    if (image == NULL)
+        return NULL;
+    image->inode = inode;
+    image->length = length;
+    image->nr_pages = (image->length + _4K - 1) / _4K;
+    image->frames = kzalloc(image->nr_pages * sizeof(uint32_t) + 1); // + 1, an empty file still gets an array
+    if (image->frames == NULL)
+    {
+        kfree(image);
+        return NULL;
+    }
+    image->users = 1;
+
+    image->next = image_cache;
+    image_cache = image;
+    return image;
+}
+
+/*
+ * image_dup
+ * Description: a forked child shares the image of its parent
+ *  Inputs: image, may be NULL
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void image_dup(image_t *image)
+{
+    if (image != NULL)
+        image->users++;
+}
+
+/*
+ * image_put
+ * Description: one process less runs the image
+ *  Inputs: image
+ *  Outputs: None
+ * Side Effects: the pages stay cached, so the next exec of the program reads nothing.
+ */
+void image_put(image_t *image)
+{
+    if (image != NULL && image->users > 0)
+        image->users--;
+}
+
+/*
+ * image_page
+ * Description: get the frame of a page of the image, reading it on first use
+ *  Inputs: image, page_idx -- page number from the start of the file
+ *  Outputs: physical address of the frame, 0 if out of memory or the file is bad
+ * Side Effects: the tail of the last page is zero, it doubles as the start of bss.
+ */
+uint32_t image_page(image_t *image, uint32_t page_idx)
+{
+    uint32_t paddr;
+    int32_t nbytes;
+
+    if (page_idx >= image->nr_pages)
+        return 0;
+    if (image->frames[page_idx] != 0)
+        return image->frames[page_idx];
+
+    paddr = alloc_frames(0);
+    if (paddr == 0 && image_cache_shrink() != 0)
+        paddr = alloc_frames(0);
+    if (paddr == 0)
+        return 0;
+
+    // the frame is reached through the kernel's direct mapping
+    nbytes = read_data(image->inode, page_idx * _4K, (int8_t *)paddr, _4K);
+    if (nbytes < 0)
+    {
+        free_frames(paddr, 0);
+        return 0;
+    }
+    memset((int8_t *)paddr + nbytes, 0, _4K - nbytes);
+
+    image->frames[page_idx] = paddr; // this is the cache's own reference
+    return paddr;
+}
+
+/*
+ * image_cache_shrink
+ * Description: free the pages of images that no process runs, called when memory runs out
+ *  Inputs: None
+ *  Outputs: number of frames given back
+ * Side Effects: the images themselves stay in the list, empty.
+ */
+uint32_t image_cache_shrink(void)
+{
+    image_t *image;
+    uint32_t count = 0;
+
+    for (image = image_cache; image != NULL; image = image->next)
+    {
+        if (image->users == 0)
+            count += image_free_pages(image);
+    }
+    return count;
+}
+
+/*
+ * image_cache_invalidate
+ * Description: forget the cached pages of a file that is about to change
+ *  Inputs: inode
+ *  Outputs: 0 for success, -1 if a process is running the file (text busy)
+ * Side Effects: None.
+ */
+int32_t image_cache_invalidate(uint32_t inode)
+{
+    image_t *image;
+    image_t **link;
+
+    for (link = &image_cache; *link != NULL; link = &((*link)->next))
+    {
+        image = *link;
+        if (image->inode != inode)
+            continue;
+
+        if (image->users != 0)
+            return -1;
+
+        image_free_pages(image);
+        *link = image->next;
+        kfree(image->frames);
+        kfree(image);
+        return 0;
+    }
+    return 0;
+}
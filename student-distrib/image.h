@@ -0,0 +1,37 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include "types.h"
+
+#ifndef ASM
+
+/* One loaded copy of an executable, shared by every process running it.
+ * Pages are read from the file the first time any process touches them and
+ * are mapped read-only everywhere, a write gets a private copy. */
+typedef struct image
+{
+    uint32_t inode;
+    uint32_t length;     // file size in bytes
+    uint32_t nr_pages;
+    uint32_t *frames;    // physical frame of each page, 0 if not read yet
+    uint32_t users;      // processes running the image
+    struct image *next;
+} image_t;
+
+/* =========================== function declarations =========================== */
+
+// find the image of an inode, or create an empty one, and count one more user
+extern image_t *image_get(uint32_t inode);
+// one more process runs the image (fork)
+extern void image_dup(image_t *image);
+// a process stops running the image, its pages stay cached
+extern void image_put(image_t *image);
+// frame holding a page of the image, read from the file if needed, 0 on failure
+extern uint32_t image_page(image_t *image, uint32_t page_idx);
+// drop cached images nobody runs, returns the number of frames freed
+extern uint32_t image_cache_shrink(void);
+// forget the cached pages of an inode that is about to change, -1 if a process runs it
+extern int32_t image_cache_invalidate(uint32_t inode);
+
+#endif /* ASM */
+#endif /* _IMAGE_H */
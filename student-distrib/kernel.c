@@ -15,6 +15,9 @@
 #include "paging.h"
 #include "fs.h"
 #include "syscall_handler.h"
+#include "sched.h"
+#include "fpu.h"
+#include "mm.h"
 // #define RUN_TESTS 
 
 /* Macros. */
@@ -74,6 +77,7 @@ void entry(unsigned long magic, unsigned long addr)
             //     printf("0x%x ", *((char *)(mod->mod_start + i)));
             // }
             // printf("\n");
+            mm_reserve_region(mod->mod_start, mod->mod_end);
             mod_count++;
             mod++;
         }
@@ -102,7 +106,11 @@ void entry(unsigned long magic, unsigned long addr)
         //        (unsigned)mbi->mmap_addr, (unsigned)mbi->mmap_length);
         for (mmap = (memory_map_t *)mbi->mmap_addr;
              (unsigned long)mmap < mbi->mmap_addr + mbi->mmap_length;
-             mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof(mmap->size)));
+             mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof(mmap->size)))
+        {
+            // type 1 is usable RAM, anything above 4GB is out of reach anyway
+            if (mmap->type == 1 && mmap->base_addr_high == 0)
+                mm_add_region(mmap->base_addr_low, (mmap->length_high != 0) ? 0xFFFFFFFF : mmap->length_low);
             // printf("    size = 0x%x, base_addr = 0x%#x%#x\n    type = 0x%x,  length    = 0x%#x%#x\n",
             //        (unsigned)mmap->size,
             //        (unsigned)mmap->base_addr_high,
@@ -110,6 +118,12 @@ void entry(unsigned long magic, unsigned long addr)
             //        (unsigned)mmap->type,
             //        (unsigned)mmap->length_high,
             //        (unsigned)mmap->length_low);
+        }
+    }
+    else if (CHECK_FLAG(mbi->flags, 0))
+    {
+        // no memory map, mem_upper is the KB of RAM starting at 1MB
+        mm_add_region(0x100000, (uint32_t)mbi->mem_upper * 1024);
     }
 
     /* Construct an LDT entry in the GDT */
@@ -172,7 +186,8 @@ void entry(unsigned long magic, unsigned long addr)
 
 
     /* Init filesystem */
-    fs_init(mbi); 
+    if (-1 == fs_init(mbi))
+        printf("No usable filesystem image, mounted an empty one\n");
 
     /* Init paging */
     paging_init();
@@ -180,6 +195,14 @@ void entry(unsigned long magic, unsigned long addr)
     terminal_init();
 
     pit_init();
+    sched_init();
+    fpu_init();
+    process_table_init();
+
+    /* One base shell per terminal, queued now and started by sched_idle below */
+    launch_base_shell(0);
+    launch_base_shell(1);
+    launch_base_shell(2);
 
     sti();
     
@@ -197,7 +220,8 @@ void entry(unsigned long magic, unsigned long addr)
     /* Run tests */
     // launch_tests(addr);
 #endif
-    for (;;);
+    /* Become the idle task, the scheduler switches back here whenever nothing is runnable */
+    sched_idle();
     /* Execute the first program ("shell") ... */
     // ece391_execute((uint8_t *)"shell");
     // asm volatile (
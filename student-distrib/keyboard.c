@@ -3,6 +3,7 @@
 #include "i8259.h"
 #include "lib.h"
 #include "syscall_handler.h"
+#include "sched.h"
 
 /* special buttons */
 static int left_shift_flag = 0;
@@ -201,6 +202,7 @@ void keyboard_int_handler(void)
                         // kbd_buf_ready[terminal_index] = 1;
                         buf_pos = 0;
                         viewing_term_ptr->kbd_buf_ready = 1;
+                        wake_up(&(viewing_term_ptr->kbd_wait_queue));
                     }
                     else
                     {
@@ -217,11 +219,13 @@ void keyboard_int_handler(void)
                     kbd_buf[buf_pos] = '\n';
                     buf_pos = 0;
                     viewing_term_ptr->kbd_buf_ready = 1;
+                    wake_up(&(viewing_term_ptr->kbd_wait_queue));
                 }
             }
         }
 
         send_eoi(KEYBOARD_IRQ); // when a release button is pressed, send EOI directly
+        sched_preempt();        // run the reader of a finished line right away
         sti();
         return;
     }
@@ -235,13 +239,14 @@ void keyboard_int_handler(void)
  *      - buf: buffer to read characters into
  *      - nbytes: size to read
  *  Outputs: # of byte read
- * Side Effects: change "kbd_buf_ready".
+ * Side Effects: change "kbd_buf_ready", sleep until a line is ready.
  */
 int read_from_kbd_buf_to_buf(int32_t fd, void *buf, int32_t nbytes)
 {
     int i;
     int nbytes_read;
     char read_char;
+    uint32_t flags;
     // int terminal_index = ((PCB_t *)get_PCB_addr(cur_pid))->terminal_id;
     // int terminal_index = current_term_id;
 
@@ -249,10 +254,11 @@ int read_from_kbd_buf_to_buf(int32_t fd, void *buf, int32_t nbytes)
     if (buf == NULL || nbytes <= 0)
         return -1;
     // memset((void *)buf, 0, 1024);
-    // wait until user presses "enter"
+    // sleep until user presses "enter"
+    cli_and_save(flags);
     while (!(running_term_ptr->kbd_buf_ready))
-    {
-    }
+        sleep_on(&(running_term_ptr->kbd_wait_queue));
+    restore_flags(flags);
 
     // start reading from keyboard buffer
     nbytes_read = 0;
@@ -262,7 +268,7 @@ int read_from_kbd_buf_to_buf(int32_t fd, void *buf, int32_t nbytes)
         if (i > KBD_BUF_SIZE - 1)
             break;
 
-        read_char = kbd_buf[i];
+        read_char = running_term_ptr->kbd_buf[i];
 
         // store the character into buf
         ((char *)buf)[i] = read_char;
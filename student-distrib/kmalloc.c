@@ -0,0 +1,274 @@
+#include "kmalloc.h"
+#include "mm.h"
+#include "lib.h"
+
+/* size classes, chosen so each one packs a 4KB slab with little slack */
+static kmem_cache_t kmalloc_caches[KMALLOC_NR_CLASSES] = {
+    {16}, {32}, {64}, {128}, {256}, {512}, {1008}, {1344}, {KMALLOC_MAX_SIZE}};
+
+static uint32_t big_bytes = 0;  // frames handed out to requests above KMALLOC_MAX_SIZE
+static uint32_t big_allocs = 0;
+static uint32_t big_frees = 0;
+static uint32_t nr_failed = 0;
+
+/*
+ * size_to_cache
+ * Description: find the smallest size class that fits
+ *  Inputs: size -- requested bytes, at most KMALLOC_MAX_SIZE
+ *  Outputs: the cache
+ * Side Effects: None.
+ */
+static kmem_cache_t *size_to_cache(uint32_t size)
+{
+    int i;
+
+    for (i = 0; i < KMALLOC_NR_CLASSES - 1; i++)
+    {
+        if (size <= kmalloc_caches[i].obj_size)
+            break;
+    }
+    return &kmalloc_caches[i];
+}
+
+static void slab_list_push(slab_t **head, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+        (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_remove(slab_t **head, slab_t *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *head = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/*
+ * slab_grow
+ * Description: take a frame from mm.c and carve it into free objects
+ *  Inputs: cache
+ *  Outputs: the new slab, NULL when out of memory
+ * Side Effects: the slab goes to the partial list.
+ */
+static slab_t *slab_grow(kmem_cache_t *cache)
+{
+    slab_t *slab;
+    uint8_t *obj;
+    uint32_t i;
+
+    slab = (slab_t *)alloc_frames(0);
+    if (slab == NULL)
+        return NULL;
+
+    if (cache->objs_per_slab == 0)
+        cache->objs_per_slab = (_4K - sizeof(slab_t)) / cache->obj_size;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->nr_used = 0;
+    slab->free_list = NULL;
+
+    // push from the end so objects come out in address order
+    obj = (uint8_t *)slab + sizeof(slab_t) + (cache->objs_per_slab - 1) * cache->obj_size;
+    for (i = 0; i < cache->objs_per_slab; i++, obj -= cache->obj_size)
+    {
+        *(void **)obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    slab_list_push(&cache->partial, slab);
+    cache->nr_slabs++;
+    return slab;
+}
+
+/*
+ * kmalloc
+ * Description: allocate kernel memory
+ *  Inputs: size -- bytes wanted
+ *  Outputs: KMALLOC_ALIGN aligned memory, NULL when out of memory or size is 0
+ * Side Effects: None.
+ */
+void *kmalloc(uint32_t size)
+{
+    kmem_cache_t *cache;
+    slab_t *slab;
+    void *obj;
+    uint32_t order;
+    uint32_t flags;
+
+    if (size == 0)
+        return NULL;
+
+    cli_and_save(flags);
+
+    // big request: whole frames, page aligned, which is how kfree tells them apart
+    if (size > KMALLOC_MAX_SIZE)
+    {
+        for (order = 0; (_4K << order) < size && order < MM_MAX_ORDER; order++)
+            ;
+        obj = (void *)alloc_frames(order);
+        if (obj == NULL || (_4K << order) < size)
+        {
+            if (obj != NULL)
+                free_frames((uint32_t)obj, order);
+            nr_failed++;
+            restore_flags(flags);
+            return NULL;
+        }
+        big_bytes += _4K << order;
+        big_allocs++;
+        restore_flags(flags);
+        return obj;
+    }
+
+    cache = size_to_cache(size);
+    slab = cache->partial;
+    if (slab == NULL)
+        slab = slab_grow(cache);
+    if (slab == NULL)
+    {
+        nr_failed++;
+        restore_flags(flags);
+        return NULL;
+    }
+
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->nr_used++;
+    if (slab->free_list == NULL)
+    {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->nr_used++;
+    cache->nr_allocs++;
+
+    restore_flags(flags);
+    return obj;
+}
+
+/*
+ * kfree
+ * Description: give back memory from kmalloc
+ *  Inputs: ptr -- pointer returned by kmalloc, or NULL
+ *  Outputs: None
+ * Side Effects: an empty slab goes back to mm.c unless it is the last one of its cache.
+ */
+void kfree(void *ptr)
+{
+    slab_t *slab;
+    kmem_cache_t *cache;
+    uint32_t order;
+    uint32_t flags;
+
+    if (ptr == NULL)
+        return;
+
+    cli_and_save(flags);
+
+    // slab objects never start a frame, the slab header is there
+    if (((uint32_t)ptr & (_4K - 1)) == 0)
+    {
+        order = frame_block_order((uint32_t)ptr);
+        big_bytes -= _4K << order;
+        big_frees++;
+        free_frames((uint32_t)ptr, order);
+        restore_flags(flags);
+        return;
+    }
+
+    slab = (slab_t *)((uint32_t)ptr & ~(_4K - 1));
+    if (slab->magic != SLAB_MAGIC)
+    {
+        printf("kfree: bad pointer 0x%x\n", (uint32_t)ptr);
+        restore_flags(flags);
+        return;
+    }
+    cache = slab->cache;
+
+    if (slab->free_list == NULL)
+    {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->nr_used--;
+
+    cache->nr_used--;
+    cache->nr_frees++;
+
+    // keep one empty slab around so a cache that hovers at the edge does not thrash
+    if (slab->nr_used == 0 && cache->nr_slabs > 1)
+    {
+        slab_list_remove(&cache->partial, slab);
+        slab->magic = 0;
+        cache->nr_slabs--;
+        free_frames((uint32_t)slab, 0);
+    }
+
+    restore_flags(flags);
+}
+
+/*
+ * kzalloc
+ * Description: kmalloc and clear
+ *  Inputs: size -- bytes wanted
+ *  Outputs: zero-filled memory, NULL when out of memory
+ * Side Effects: None.
+ */
+void *kzalloc(uint32_t size)
+{
+    void *ptr = kmalloc(size);
+
+    if (ptr != NULL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+/*
+ * kmalloc_get_stats
+ * Description: sum up the size classes and big allocations
+ *  Inputs: stats -- filled in
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void kmalloc_get_stats(kmalloc_stats_t *stats)
+{
+    int i;
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    stats->heap_bytes = big_bytes;
+    stats->used_bytes = big_bytes;
+    stats->nr_allocs = big_allocs;
+    stats->nr_frees = big_frees;
+    stats->nr_failed = nr_failed;
+
+    for (i = 0; i < KMALLOC_NR_CLASSES; i++)
+    {
+        stats->heap_bytes += kmalloc_caches[i].nr_slabs * _4K;
+        stats->used_bytes += kmalloc_caches[i].nr_used * kmalloc_caches[i].obj_size;
+        stats->nr_allocs += kmalloc_caches[i].nr_allocs;
+        stats->nr_frees += kmalloc_caches[i].nr_frees;
+    }
+
+    restore_flags(flags);
+}
+
+const kmem_cache_t *kmalloc_get_cache(uint32_t idx)
+{
+    if (idx >= KMALLOC_NR_CLASSES)
+        return NULL;
+    return &kmalloc_caches[idx];
+}
@@ -0,0 +1,68 @@
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include "types.h"
+
+/* Small requests are served from slab caches, one cache per size class.
+ * A slab is a single 4KB frame: a slab_t header, then equal sized objects.
+ * Requests bigger than the largest class get whole frames from mm.c. */
+#define KMALLOC_NR_CLASSES 9
+#define KMALLOC_MAX_SIZE 2032 // (4096 - header) / 2, rounded down to 16 bytes
+#define KMALLOC_ALIGN 16      // every object is 16-byte aligned, FXSAVE areas need it
+
+#define SLAB_MAGIC 0x51AB51AB
+
+#ifndef ASM
+
+struct kmem_cache;
+
+// lives at the start of every slab frame
+typedef struct slab
+{
+    uint32_t magic;
+    struct kmem_cache *cache;
+    struct slab *next; // partial or full list of the cache
+    struct slab *prev;
+    void *free_list;   // free objects, linked through their first word
+    uint32_t nr_used;
+    uint32_t pad[2];   // keep the header a multiple of KMALLOC_ALIGN
+} slab_t;
+
+// one size class
+typedef struct kmem_cache
+{
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    slab_t *partial;   // slabs with at least one free object
+    slab_t *full;
+    uint32_t nr_slabs;
+    uint32_t nr_used;  // live objects
+    uint32_t nr_allocs; // kmalloc calls served since boot
+    uint32_t nr_frees;
+} kmem_cache_t;
+
+// heap totals, fragmentation is 1 - used_bytes / heap_bytes
+typedef struct kmalloc_stats
+{
+    uint32_t heap_bytes; // frames held by slabs and big allocations
+    uint32_t used_bytes; // live objects, counted at their size class
+    uint32_t nr_allocs;
+    uint32_t nr_frees;
+    uint32_t nr_failed;  // out of memory
+} kmalloc_stats_t;
+
+/* =========================== function declarations =========================== */
+
+// allocate size bytes of kernel memory, NULL when out of memory
+extern void *kmalloc(uint32_t size);
+// give back memory from kmalloc, NULL is ignored
+extern void kfree(void *ptr);
+// allocate and clear
+extern void *kzalloc(uint32_t size);
+// heap totals
+extern void kmalloc_get_stats(kmalloc_stats_t *stats);
+// per size class numbers, NULL if idx is out of range
+extern const kmem_cache_t *kmalloc_get_cache(uint32_t idx);
+
+#endif /* ASM */
+#endif /* _KMALLOC_H */
@@ -833,10 +833,25 @@ int read_cr3()
  *
  * Inputs: none
  * Outputs: none
- * Side Effects: flush_tlb
+ * Side Effects: drops every TLB entry except global (kernel) pages
  * Reference: OSdev
  */
 void flush_tlb()
 {
     write_cr3(read_cr3());
 }
+
+/* invlpg
+ *
+ * Inputs: vaddr -- any address inside the page
+ * Outputs: none
+ * Side Effects: drops the TLB entry of one page, global or not
+ * Reference: OSdev
+ */
+void invlpg(uint32_t vaddr)
+{
+    asm volatile("invlpg (%0)"
+                 :
+                 : "r"(vaddr)
+                 : "memory");
+}
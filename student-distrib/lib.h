@@ -80,6 +80,31 @@ static inline uint32_t inl(port) {
     return val;
 }
 
+/* Reads the time-stamp counter, which counts CPU cycles since reset */
+static inline uint64_t rdtsc(void) {
+    uint64_t val;
+    asm volatile ("rdtsc"
+            : "=A"(val)
+            :
+            : "memory"
+    );
+    return val;
+}
+
+/* Divides a 64-bit value by a 32-bit one without libgcc; quotient bits
+ * above 32 are dropped, so the result wraps around like a 32-bit counter */
+static inline uint32_t div64_32(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32) % d;
+    uint32_t lo = (uint32_t)n;
+    uint32_t q, r;
+    asm ("divl %4"
+            : "=a"(q), "=d"(r)
+            : "a"(lo), "d"(hi), "rm"(d)
+            : "cc"
+    );
+    return q;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -196,5 +221,7 @@ int read_cr3();
 
 void flush_tlb();
 
+void invlpg(uint32_t vaddr);
+
 
 #endif /* _LIB_H */
@@ -0,0 +1,73 @@
+#include "lz4.h"
+#include "lib.h"
+
+/*
+ * read_length
+ * Description: add up the extra length bytes after a token nibble of 15, they stop at one below 255
+ *  Inputs: ip -- next input byte, moved past the length, iend -- end of the input, len -- the nibble
+ *  Outputs: the whole length, or -1 if the input ends first
+ * Side Effects: None.
+ */
+static int32_t read_length(const uint8_t **ip, const uint8_t *iend, uint32_t len)
+{
+    uint8_t byte;
+
+    if (len != 15)
+        return len;
+    do
+    {
+        if (*ip >= iend)
+            return -1;
+        byte = *(*ip)++;
+        len += byte;
+    } while (byte == 255);
+    return len;
+}
+
+/*
+ * lz4_decompress
+ * Description: decode a buffer in LZ4 block format: sequences of a token, literals, and a match
+ *              copied from earlier output. The last sequence has literals only.
+ *  Inputs: src, src_len -- compressed data, dst, dst_len -- where it goes and how much room there is
+ *  Outputs: bytes written to dst, -1 if the data is corrupt or would overflow dst
+ * Side Effects: None. Never reads or writes out of bounds, whatever the input holds.
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len)
+{
+    const uint8_t *ip = src, *iend = src + src_len;
+    uint8_t *op = dst, *oend = dst + dst_len;
+    const uint8_t *match;
+    uint32_t token, offset;
+    int32_t len;
+
+    while (ip < iend)
+    {
+        token = *ip++;
+
+        len = read_length(&ip, iend, token >> 4);
+        if (len == -1 || (uint32_t)len > (uint32_t)(iend - ip) || (uint32_t)len > (uint32_t)(oend - op))
+            return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst))
+            return -1;
+
+        len = read_length(&ip, iend, token & 15);
+        if (len == -1 || (uint32_t)len + LZ4_MIN_MATCH > (uint32_t)(oend - op))
+            return -1;
+        len += LZ4_MIN_MATCH;
+
+        // byte by byte, a match may overlap the bytes it produces
+        for (match = op - offset; len > 0; len--)
+            *op++ = *match++;
+    }
+    return op - dst;
+}
@@ -0,0 +1,16 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+#define LZ4_MIN_MATCH 4 // a match copies at least this many bytes
+
+#ifndef ASM
+
+/* =========================== function declarations =========================== */
+
+// decode one LZ4 block format buffer, bytes written or -1 if it is corrupt or does not fit in dst
+extern int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len);
+
+#endif /* ASM */
+#endif /* _LZ4_H */
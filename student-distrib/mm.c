@@ -0,0 +1,306 @@
+#include "mm.h"
+#include "lib.h"
+
+/* Buddy allocator over the directly mapped physical memory [MM_START, MM_END).
+ * A free block of order n starts at a frame number aligned to 2^n, its buddy
+ * is the frame number with bit n flipped. Blocks merge with their buddy on
+ * free, and split in halves on allocation. */
+
+static frame_t frames[MM_NR_FRAMES];
+static uint16_t free_area[MM_MAX_ORDER + 1]; // head of the free list of each order
+static uint32_t nr_free_frames = 0;
+static uint32_t nr_total_frames = 0;
+
+static uint32_t reserved_start[MM_MAX_RESERVED];
+static uint32_t reserved_end[MM_MAX_RESERVED];
+static uint32_t nr_reserved = 0;
+static uint8_t mm_ready = 0;
+
+/*
+ * mm_setup
+ * Description: mark every frame reserved and empty the free lists
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void mm_setup(void)
+{
+    int i;
+
+    for (i = 0; i < MM_NR_FRAMES; i++)
+    {
+        frames[i].next = FRAME_NONE;
+        frames[i].prev = FRAME_NONE;
+        frames[i].order = 0;
+        frames[i].flags = FRAME_RESERVED;
+        frames[i].ref = 0;
+    }
+    for (i = 0; i <= MM_MAX_ORDER; i++)
+        free_area[i] = FRAME_NONE;
+
+    mm_ready = 1;
+}
+
+static void free_list_push(uint32_t pfn, uint32_t order)
+{
+    frames[pfn].prev = FRAME_NONE;
+    frames[pfn].next = free_area[order];
+    if (free_area[order] != FRAME_NONE)
+        frames[free_area[order]].prev = pfn;
+    free_area[order] = pfn;
+
+    frames[pfn].order = order;
+    frames[pfn].flags = FRAME_FREE;
+}
+
+static void free_list_remove(uint32_t pfn, uint32_t order)
+{
+    if (frames[pfn].prev != FRAME_NONE)
+        frames[frames[pfn].prev].next = frames[pfn].next;
+    else
+        free_area[order] = frames[pfn].next;
+    if (frames[pfn].next != FRAME_NONE)
+        frames[frames[pfn].next].prev = frames[pfn].prev;
+
+    frames[pfn].next = FRAME_NONE;
+    frames[pfn].prev = FRAME_NONE;
+    frames[pfn].flags = 0;
+}
+
+/*
+ * free_block
+ * Description: put a block back, merging it with its buddy as long as possible
+ *  Inputs: pfn -- first frame number, order -- size of the block
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void free_block(uint32_t pfn, uint32_t order)
+{
+    uint32_t buddy;
+
+    nr_free_frames += 1 << order;
+
+    while (order < MM_MAX_ORDER)
+    {
+        buddy = pfn ^ (1 << order);
+        if (buddy >= MM_NR_FRAMES || !(frames[buddy].flags & FRAME_FREE) || frames[buddy].order != order)
+            break;
+
+        free_list_remove(buddy, order);
+        pfn &= ~(1 << order);
+        order++;
+    }
+
+    free_list_push(pfn, order);
+}
+
+/*
+ * is_reserved
+ * Description: check whether a frame overlaps a reserved region
+ *  Inputs: addr -- physical address of the frame
+ *  Outputs: 1 if reserved, 0 otherwise
+ * Side Effects: None.
+ */
+static int32_t is_reserved(uint32_t addr)
+{
+    uint32_t i;
+
+    for (i = 0; i < nr_reserved; i++)
+    {
+        if (addr + _4K > reserved_start[i] && addr < reserved_end[i])
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * mm_reserve_region
+ * Description: keep a physical range (a multiboot module, say) out of the allocator
+ *  Inputs: start, end -- physical range [start, end)
+ *  Outputs: None
+ * Side Effects: only affects regions added after this call.
+ */
+void mm_reserve_region(uint32_t start, uint32_t end)
+{
+    if (nr_reserved >= MM_MAX_RESERVED)
+        return;
+
+    reserved_start[nr_reserved] = start;
+    reserved_end[nr_reserved] = end;
+    nr_reserved++;
+}
+
+/*
+ * mm_add_region
+ * Description: free every whole frame of a usable RAM region that lies inside [MM_START, MM_END)
+ *  Inputs: base, len -- the region from the multiboot memory map
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void mm_add_region(uint32_t base, uint32_t len)
+{
+    uint32_t start, end, addr;
+
+    if (!mm_ready)
+        mm_setup();
+
+    // round inwards to whole frames, and clip to what the kernel maps
+    start = (base + _4K - 1) & ~(_4K - 1);
+    end = (base + len < base) ? MM_END : ((base + len) & ~(_4K - 1)); // len may run past 4GB
+    if (start < MM_START)
+        start = MM_START;
+    if (end > MM_END)
+        end = MM_END;
+
+    for (addr = start; addr < end; addr += _4K)
+    {
+        if (!(frames[addr >> OFFSET_12].flags & FRAME_RESERVED) || is_reserved(addr))
+            continue;
+
+        frames[addr >> OFFSET_12].flags = 0;
+        nr_total_frames++;
+        free_block(addr >> OFFSET_12, 0);
+    }
+}
+
+/*
+ * alloc_frames
+ * Description: take a block of 2^order frames, splitting a bigger block if needed
+ *  Inputs: order -- 0 for 4KB ... MM_ORDER_4M for 4MB
+ *  Outputs: physical address of the block, 0 if there is no block big enough
+ * Side Effects: None.
+ */
+uint32_t alloc_frames(uint32_t order)
+{
+    uint32_t cur_order, pfn;
+    uint32_t flags;
+
+    if (!mm_ready || order > MM_MAX_ORDER)
+        return 0;
+
+    cli_and_save(flags);
+
+    for (cur_order = order; cur_order <= MM_MAX_ORDER; cur_order++)
+    {
+        if (free_area[cur_order] != FRAME_NONE)
+            break;
+    }
+    if (cur_order > MM_MAX_ORDER)
+    {
+        restore_flags(flags);
+        return 0;
+    }
+
+    pfn = free_area[cur_order];
+    free_list_remove(pfn, cur_order);
+
+    // hand the upper halves back until the block has the size we want
+    while (cur_order > order)
+    {
+        cur_order--;
+        free_list_push(pfn + (1 << cur_order), cur_order);
+    }
+
+    frames[pfn].order = order;
+    frames[pfn].ref = 1;
+    nr_free_frames -= 1 << order;
+
+    restore_flags(flags);
+    return pfn << OFFSET_12;
+}
+
+/*
+ * free_frames
+ * Description: give a block back to the allocator
+ *  Inputs: addr -- address returned by alloc_frames, order -- the order it was allocated with
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void free_frames(uint32_t addr, uint32_t order)
+{
+    uint32_t pfn = addr >> OFFSET_12;
+    uint32_t flags;
+
+    if (addr < MM_START || addr >= MM_END || (frames[pfn].flags & (FRAME_FREE | FRAME_RESERVED)))
+    {
+        printf("free_frames: bad frame 0x%x\n", addr);
+        return;
+    }
+
+    cli_and_save(flags);
+    frames[pfn].ref = 0;
+    free_block(pfn, order);
+    restore_flags(flags);
+}
+
+/*
+ * alloc_zeroed_page
+ * Description: allocate one 4KB frame and clear it through the direct mapping
+ *  Inputs: None
+ *  Outputs: physical address of the frame, 0 when out of memory
+ * Side Effects: None.
+ */
+uint32_t alloc_zeroed_page(void)
+{
+    uint32_t addr = alloc_frames(0);
+
+    if (addr != 0)
+        memset((void *)addr, 0, _4K);
+    return addr;
+}
+
+/*
+ * frame_get
+ * Description: take a reference to a shared 4KB frame
+ *  Inputs: addr -- physical address of the frame
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void frame_get(uint32_t addr)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    frames[addr >> OFFSET_12].ref++;
+    restore_flags(flags);
+}
+
+/*
+ * frame_put
+ * Description: drop a reference to a 4KB frame, free it when nobody maps it any more
+ *  Inputs: addr -- physical address of the frame
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void frame_put(uint32_t addr)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (--frames[addr >> OFFSET_12].ref == 0)
+    {
+        frames[addr >> OFFSET_12].ref = 1; // free_frames wants an allocated frame
+        free_frames(addr, 0);
+    }
+    restore_flags(flags);
+}
+
+uint32_t frame_ref(uint32_t addr)
+{
+    return frames[addr >> OFFSET_12].ref;
+}
+
+uint32_t frame_block_order(uint32_t addr)
+{
+    return frames[addr >> OFFSET_12].order;
+}
+
+uint32_t mm_nr_free_frames(void)
+{
+    return nr_free_frames;
+}
+
+uint32_t mm_nr_total_frames(void)
+{
+    return nr_total_frames;
+}
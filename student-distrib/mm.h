@@ -0,0 +1,64 @@
+#ifndef _MM_H
+#define _MM_H
+
+#include "types.h"
+#include "paging.h"
+
+/* Physical frames are handed out by a buddy allocator.
+ * Order 0 is a single 4KB frame, order MM_MAX_ORDER is a 4MB page. */
+#define MM_MAX_ORDER 10
+#define MM_ORDER_4M MM_MAX_ORDER
+
+/* the kernel maps physical memory 1:1 below MM_END, so every frame it
+ * hands out is also directly addressable by the kernel */
+#define MM_START _8M   // everything below is the kernel page, video memory and PCBs
+#define MM_END _128M   // user space starts here
+#define MM_NR_FRAMES (MM_END >> OFFSET_12)
+
+#define FRAME_NONE 0xFFFF // end of a free list
+
+/* frame flags */
+#define FRAME_RESERVED 0x01 // not usable RAM, or owned by the kernel image
+#define FRAME_FREE 0x02     // first frame of a block sitting in a free list
+
+#define MM_MAX_RESERVED 8 // multiboot modules we keep away from the allocator
+
+#ifndef ASM
+
+// one per 4KB physical frame
+typedef struct frame
+{
+    uint16_t next; // free list links, frame numbers
+    uint16_t prev;
+    uint8_t order; // size of the block this frame heads
+    uint8_t flags;
+    uint16_t ref;  // number of mappings of an allocated frame
+} frame_t;
+
+/* =========================== function declarations =========================== */
+
+// keep [start, end) out of the allocator, call before mm_add_region
+extern void mm_reserve_region(uint32_t start, uint32_t end);
+// hand a usable RAM region from the multiboot memory map to the allocator
+extern void mm_add_region(uint32_t base, uint32_t len);
+// allocate 2^order contiguous frames, returns the physical address or 0
+extern uint32_t alloc_frames(uint32_t order);
+// give back a block returned by alloc_frames
+extern void free_frames(uint32_t addr, uint32_t order);
+// allocate a single zero-filled 4KB frame, returns 0 when out of memory
+extern uint32_t alloc_zeroed_page(void);
+// take another reference to an allocated 4KB frame, for sharing it between mappings
+extern void frame_get(uint32_t addr);
+// drop a reference, the frame is freed with the last one
+extern void frame_put(uint32_t addr);
+// number of references to an allocated frame
+extern uint32_t frame_ref(uint32_t addr);
+// order a block was allocated with, addr is its first frame
+extern uint32_t frame_block_order(uint32_t addr);
+// how many 4KB frames are free
+extern uint32_t mm_nr_free_frames(void);
+// how many 4KB frames the memory map gave us
+extern uint32_t mm_nr_total_frames(void);
+
+#endif /* ASM */
+#endif /* _MM_H */
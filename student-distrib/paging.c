@@ -1,4 +1,6 @@
 #include "paging.h"
+#include "mm.h"
+#include "lib.h"
 
 /* paging_init
  * Description: Initialize paging.
@@ -35,9 +37,13 @@ void paging_init(void)
         "movl %%eax, %%cr4          \n\t"
 
         "movl %%cr0, %%eax          \n\t"
-        "orl $0x80000000, %%eax     \n\t"
+        "orl $0x80010000, %%eax     \n\t"  // PG, and WP so the kernel also faults on read-only user pages
         "movl %%eax, %%cr0          \n\t"
 
+        "movl %%cr4, %%eax          \n\t"
+        "orl $0x00000080, %%eax     \n\t"  // PGE, kernel pages survive CR3 reloads
+        "movl %%eax, %%cr4          \n\t"
+
         :
         : "r"(page_dir_base)
         : "eax");
@@ -82,7 +88,7 @@ void init_page_dir()
         pde->accessed = 0;      // Have not been read during virtual address translation.
         pde->dirty = 1;         // Has been written.
         pde->pageSize = 1;      // 4MB page for kernel space
-        pde->global = 0;        // Global page ignore.
+        pde->global = 1;        // Same in every process, keep it in the TLB.
         pde->avail = 0;         // Not used.
         pde->pg_attri = 0;      // Reserved and be set to 0.
         pde->addr_0 = 0;        // Bits 39-32 of address.
@@ -112,6 +118,7 @@ void init_page_dir()
     }
 
     // Initialization for the other 1022 directory enties (4MB indirection, connect 4MB pages).
+    // 8MB ~ 128MB is mapped 1:1 for the kernel only, so it can reach every frame mm.c hands out
     int i;
     for (i = 2; i < NUM_PAGE_TABLE_DESC; i++)
     {
@@ -119,15 +126,15 @@ void init_page_dir()
             continue;
         page_dir_entry_u the_page_dir_entry;
         page_dir_entry_4MB_t *pde = &(the_page_dir_entry.kernel_page_desc);
-        pde->present = 0; // Not in memory.
+        pde->present = (i < DIRECT_MAP_END / _4M); // direct map, or not in memory.
         pde->r_w = 1;
-        pde->user_super = 1;    // May be accessed by all.
+        pde->user_super = (i >= DIRECT_MAP_END / _4M); // direct map is supervisor only.
         pde->write_through = 0; // Write back.
         pde->cache_disable = 0; // Enable page caching.
         pde->accessed = 0;      // Have not been read during virtual address translation.
         pde->dirty = 0;         // Have not been written.
         pde->pageSize = 1;      // 4MB page for kernel space
-        pde->global = 0;        // Global page ignore
+        pde->global = pde->present; // direct map is the same in every process.
         pde->avail = 0;         // Not used.
         pde->pg_attri = 0;      // Reserved and be set to 0.
         pde->addr_0 = 0;        // Bits 39-32 of address.
@@ -171,7 +178,7 @@ void init_user_page_table()
         the_page_table_entry.accessed = 0;      // Have not been read during virtual address translation.
         the_page_table_entry.dirty = 0;
         the_page_table_entry.pg_attri = 0;          // Reserved and be set to 0.
-        the_page_table_entry.global = 0;            // Global page ignore.
+        the_page_table_entry.global = the_page_table_entry.present; // video memory is the same in every process.
         the_page_table_entry.avail = 0;             // Not used.
         the_page_table_entry.pg_addr = (uint32_t)i; // 20-bit address for 4KB pages.
 
@@ -208,7 +215,7 @@ void init_user_page_table()
  * Description: Change the mapping of the chunk of memory that the user get
  * Inputs: None
  * Outputs: None
- * Side Effects: None
+ * Side Effects: invlpg the vidmap page
  */
 void switch_usrmap(int index, int present)
 {
@@ -225,12 +232,264 @@ void switch_usrmap(int index, int present)
     the_page_table_entry.accessed = 0;      // Have not been read during virtual address translation.
     the_page_table_entry.dirty = 0;
     the_page_table_entry.pg_attri = 0;              // Reserved and be set to 0.
-    the_page_table_entry.global = present;                // Global page ignore.
+    the_page_table_entry.global = 0;                // user space, never global.
     the_page_table_entry.avail = 0;                 // Not used.
     the_page_table_entry.pg_addr = (uint32_t)index; // 20-bit address for 4KB pages.
 
     // write into usr_page_table_base
     usrmap_page_table_base[VIDEO_START >> 12] = the_page_table_entry;
+    invlpg(VIDMAP_ADDR);
+}
+
+
+
+/* alloc_page_table
+ * Description: Allocate an empty page table for a 4MB piece of user space.
+ * Inputs: None
+ * Outputs: the page table (its physical address, the kernel maps it 1:1), NULL when out of memory
+ * Side Effects: None
+ */
+page_table_entry_t *alloc_page_table(void)
+{
+    return (page_table_entry_t *)alloc_zeroed_page();
+}
+
+/* alloc_page_dir
+ * Description: Allocate a page directory for a process. The kernel half (every PDE outside
+ *              user space, and the shared vidmap table) is copied from page_dir_base, user
+ *              space starts out empty.
+ * Inputs: None
+ * Outputs: the page directory, NULL when out of memory
+ * Side Effects: None
+ */
+page_dir_entry_u *alloc_page_dir(void)
+{
+    page_dir_entry_u *pgdir = (page_dir_entry_u *)alloc_frames(0);
+    int i;
+
+    if (pgdir == NULL)
+        return NULL;
+
+    for (i = 0; i < NUM_PAGE_TABLE_DESC; i++)
+    {
+        if (i >= USER_PDE_IDX && i < USER_PDE_IDX + USER_NR_PDE && i != VIDMAP_PDE_IDX)
+            *((uint32_t *)&pgdir[i]) = 0;
+        else
+            pgdir[i] = page_dir_base[i];
+    }
+    return pgdir;
+}
+
+/* free_page_dir
+ * Description: Drop every page mapped in user space, free the page tables, then the directory.
+ * Inputs: pgdir -- page directory of a process
+ * Outputs: None
+ * Side Effects: the directory must not be in CR3 any more.
+ */
+void free_page_dir(page_dir_entry_u *pgdir)
+{
+    page_table_entry_t *pt;
+    int i, j;
+
+    for (i = USER_PDE_IDX; i < USER_PDE_IDX + USER_NR_PDE; i++)
+    {
+        if (i == VIDMAP_PDE_IDX || !pgdir[i].user_page_table_desc.present)
+            continue;
+
+        pt = (page_table_entry_t *)(pgdir[i].user_page_table_desc.page_table_base << OFFSET_12);
+        for (j = 0; j < NUM_PAGE_DESC; j++)
+        {
+            if (pt[j].present && !(pt[j].avail & PTE_AVAIL_NOREF))
+                frame_put(pt[j].pg_addr << OFFSET_12); // may be shared with other processes
+        }
+        free_frames((uint32_t)pt, 0);
+    }
+    free_frames((uint32_t)pgdir, 0);
+}
+
+/* set_user_pde
+ * Description: Point a user space PDE at a page table.
+ * Inputs: pde -- the entry, pt -- the page table
+ * Outputs: None
+ * Side Effects: None
+ */
+static void set_user_pde(page_dir_entry_u *pde_u, page_table_entry_t *pt)
+{
+    page_dir_entry_u the_page_dir_entry;
+    page_dir_entry_4KB_t *pde = &(the_page_dir_entry.user_page_table_desc);
+
+    pde->present = 1;
+    pde->r_w = 1;
+    pde->user_super = 1;    // May be accessed by all.
+    pde->write_through = 0; // Write back.
+    pde->cache_disable = 0; // Enable page caching.
+    pde->accessed = 0;      // Have not been read during virtual address translation.
+    pde->avail0 = 0;        // Not used.
+    pde->pageSize = 0;      // 4KB pages, a process only gets the frames it touches
+    pde->avail1 = 0;        // Not used.
+    pde->page_table_base = (uint32_t)pt >> 12;
+
+    *pde_u = the_page_dir_entry;
+}
+
+/* user_pte
+ * Description: Find the page table entry of a user address.
+ * Inputs: pgdir -- page directory of a process, vaddr -- user address,
+ *         alloc -- create the page table if it is missing
+ * Outputs: the entry, NULL if vaddr is not in user space or out of memory
+ * Side Effects: a new page table goes straight into pgdir, no TLB flush is needed for it.
+ */
+page_table_entry_t *user_pte(page_dir_entry_u *pgdir, uint32_t vaddr, int32_t alloc)
+{
+    uint32_t pdi = vaddr >> 22;
+    page_table_entry_t *pt;
+
+    if (pdi < USER_PDE_IDX || pdi >= USER_PDE_IDX + USER_NR_PDE || pdi == VIDMAP_PDE_IDX)
+        return NULL;
+
+    if (!pgdir[pdi].user_page_table_desc.present)
+    {
+        if (!alloc)
+            return NULL;
+        pt = alloc_page_table();
+        if (pt == NULL)
+            return NULL;
+        set_user_pde(&pgdir[pdi], pt);
+    }
+
+    pt = (page_table_entry_t *)(pgdir[pdi].user_page_table_desc.page_table_base << OFFSET_12);
+    return &(pt[PTE_IDX(vaddr)]);
+}
+
+/* map_user_page
+ * Description: Map a 4KB frame at a user address.
+ * Inputs: pgdir -- page directory of a process, vaddr -- virtual address, paddr -- physical frame,
+ *         mode -- PAGE_RW, PAGE_RO, PAGE_COW (read-only until written, then private),
+ *         or PAGE_SHARED (read-only, paddr is not refcounted)
+ * Outputs: 0 for success, -1 if vaddr is not in user space or out of memory
+ * Side Effects: the caller invalidates the page (flush_user_page) if pgdir is live.
+ */
+int32_t map_user_page(page_dir_entry_u *pgdir, uint32_t vaddr, uint32_t paddr, int32_t mode)
+{
+    page_table_entry_t the_page_table_entry;
+    page_table_entry_t *pte = user_pte(pgdir, vaddr, 1);
+
+    if (pte == NULL)
+        return -1;
+
+    the_page_table_entry.present = 1;
+    the_page_table_entry.r_w = (mode == PAGE_RW);
+    the_page_table_entry.usr_super = 1;     // May be accessed by all.
+    the_page_table_entry.write_through = 0; // Write back.
+    the_page_table_entry.cache_disable = 0; // Enable page caching.
+    the_page_table_entry.accessed = 0;      // Have not been read during virtual address translation.
+    the_page_table_entry.dirty = 0;
+    the_page_table_entry.pg_attri = 0;      // Reserved and be set to 0.
+    the_page_table_entry.global = 0;        // Global page ignore.
+    the_page_table_entry.avail = (mode == PAGE_COW) ? PTE_AVAIL_COW : (mode == PAGE_SHARED) ? PTE_AVAIL_NOREF : 0;
+    the_page_table_entry.pg_addr = paddr >> OFFSET_12;
+
+    *pte = the_page_table_entry;
+    return 0;
+}
+
+/* unmap_user_page
+ * Description: Remove the mapping of a user page, if there is one.
+ * Inputs: pgdir -- page directory of a process, vaddr -- any address inside the page
+ * Outputs: None
+ * Side Effects: the caller flushes the TLB if pgdir is live.
+ */
+void unmap_user_page(page_dir_entry_u *pgdir, uint32_t vaddr)
+{
+    page_table_entry_t *pte = user_pte(pgdir, vaddr, 0);
+
+    if (pte == NULL || !pte->present)
+        return;
+
+    if (!(pte->avail & PTE_AVAIL_NOREF))
+        frame_put(pte->pg_addr << OFFSET_12);
+    *((uint32_t *)pte) = 0;
+}
+
+/* load_page_dir
+ * Description: Switch address space.
+ * Inputs: pgdir -- page directory of a process, NULL for the kernel's own page_dir_base
+ * Outputs: None
+ * Side Effects: loads CR3, global (kernel) pages stay in the TLB
+ */
+void load_page_dir(page_dir_entry_u *pgdir)
+{
+    write_cr3((int)(pgdir != NULL ? pgdir : page_dir_base));
+}
+
+/* fork_page_tables
+ * Description: Duplicate the user space of a process for fork. Writable pages become
+ *              copy-on-write in both processes, every frame gets one more reference.
+ * Inputs: pgdir -- page directory of the parent, child_pgdir -- fresh from alloc_page_dir
+ * Outputs: 0 for success, -1 when out of memory (the caller frees child_pgdir)
+ * Side Effects: the caller flushes the TLB, the parent's pages turned read-only.
+ */
+int32_t fork_page_tables(page_dir_entry_u *pgdir, page_dir_entry_u *child_pgdir)
+{
+    page_table_entry_t *pt, *child_pt;
+    int i, j;
+
+    for (i = USER_PDE_IDX; i < USER_PDE_IDX + USER_NR_PDE; i++)
+    {
+        if (i == VIDMAP_PDE_IDX || !pgdir[i].user_page_table_desc.present)
+            continue;
+
+        child_pt = alloc_page_table();
+        if (child_pt == NULL)
+            return -1;
+        set_user_pde(&child_pgdir[i], child_pt);
+
+        pt = (page_table_entry_t *)(pgdir[i].user_page_table_desc.page_table_base << OFFSET_12);
+        for (j = 0; j < NUM_PAGE_DESC; j++)
+        {
+            if (!pt[j].present)
+                continue;
+
+            if (pt[j].r_w)
+            {
+                pt[j].r_w = 0;
+                pt[j].avail |= PTE_AVAIL_COW;
+            }
+            if (!(pt[j].avail & PTE_AVAIL_NOREF))
+                frame_get(pt[j].pg_addr << OFFSET_12);
+            child_pt[j] = pt[j];
+        }
+    }
+
+    return 0;
 }
 
+/* flush_user_page
+ * Description: Make a change to one user page of the running process visible to the CPU.
+ * Inputs: vaddr -- any address inside the page
+ * Outputs: None
+ * Side Effects: invlpg
+ */
+void flush_user_page(uint32_t vaddr)
+{
+    invlpg(vaddr);
+}
 
+/* flush_user_range
+ * Description: Make changes to the user pages in [start, end) of the running process visible.
+ * Inputs: start, end -- page aligned
+ * Outputs: None
+ * Side Effects: invlpg each page, or flush the TLB when there are too many of them
+ */
+void flush_user_range(uint32_t start, uint32_t end)
+{
+    uint32_t addr;
+
+    if ((end - start) / _4K > FLUSH_RANGE_MAX)
+    {
+        flush_tlb();
+        return;
+    }
+    for (addr = start; addr < end; addr += _4K)
+        invlpg(addr);
+}
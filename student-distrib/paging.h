@@ -18,10 +18,26 @@
 #define NUM_PAGE_TABLE_DESC 1024 /* each desc described a page table */
 #define NUM_PAGE_DESC 1024       /* each desc described a 4k page    */
 #define VIDEO_START 0xB8000
-#define VIDEO VIDEO_START
+#define VIDEO 0xB8000
 #define VIRTUAL_VIDEO_START (256 * 1024 * 1024)
 #define KERNEL_START (4 * 1024 * 1024)
 
+#define USER_PDE_IDX (_128M >> 22)    // user space starts with the 4MB program window
+#define USER_NR_PDE 16                // user space is 128MB ~ 192MB, mapped with 4KB pages
+#define VIDMAP_PDE_IDX (USER_PDE_IDX + 1) // 132MB, the vidmap table, shared by every process
+#define DIRECT_MAP_END _128M          // physical memory below this is mapped 1:1 for the kernel
+#define VIDMAP_ADDR (VIDMAP_PDE_IDX * _4M + VIDEO_START) // the screen as vidmap hands it out
+#define FLUSH_RANGE_MAX 32            // pages worth an invlpg each, bigger ranges flush the TLB
+#define PTE_IDX(vaddr) (((vaddr) >> OFFSET_12) & (NUM_PAGE_DESC - 1))
+
+/* how map_user_page maps a frame */
+#define PAGE_RO 0   // read-only, writes kill the process
+#define PAGE_RW 1
+#define PAGE_COW 2  // read-only, the first write gets a private copy of the frame
+#define PAGE_SHARED 3 // read-only, the frame is not the frame allocator's (file data in the fs image)
+#define PTE_AVAIL_COW 0x1   // in the avail bits of a page table entry
+#define PTE_AVAIL_NOREF 0x2 // no frame reference is held, see PAGE_SHARED
+
 #ifndef ASM
 
 //****************Indirection1: 4MB****************
@@ -97,6 +113,18 @@ void init_page_dir();
 
 void init_user_page_table();
 
+// a page directory per process, user space page tables come from mm.c
+extern page_table_entry_t *alloc_page_table(void);
+extern page_dir_entry_u *alloc_page_dir(void);
+extern void free_page_dir(page_dir_entry_u *pgdir);
+extern page_table_entry_t *user_pte(page_dir_entry_u *pgdir, uint32_t vaddr, int32_t alloc);
+extern int32_t map_user_page(page_dir_entry_u *pgdir, uint32_t vaddr, uint32_t paddr, int32_t mode);
+extern void unmap_user_page(page_dir_entry_u *pgdir, uint32_t vaddr);
+extern void load_page_dir(page_dir_entry_u *pgdir);
+extern int32_t fork_page_tables(page_dir_entry_u *pgdir, page_dir_entry_u *child_pgdir);
+extern void flush_user_page(uint32_t vaddr);
+extern void flush_user_range(uint32_t start, uint32_t end);
+
 // this is in ASM file
 extern void enable_paging(page_dir_entry_u *page_dir_base);
 
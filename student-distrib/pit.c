@@ -1,9 +1,13 @@
 #include "pit.h"
 #include "i8259.h"
-#include "syscall_handler.h"
+#include "sched.h"
 #include "terminal.h"
 #include "lib.h"
 
+uint32_t tsc_per_tick;
+
+static void pit_calibrate_tsc(void);
+
 /*
  * pit_init
  * Description: initialize the pit
@@ -43,7 +47,7 @@ void pit_init(void)
                                 (both 8 bit transfers are to the same IO port, sequentially – a word transfer will not work).
 
         1 to 3       Operating mode :
-                        0 0 0 = Mode 0 (interrupt on terminal count)
+                        0 0 0 = Mode 0 (interrupt on terminal count) (*)
                         0 0 1 = Mode 1 (hardware re-triggerable one-shot)
                         0 1 0 = Mode 2 (rate generator)
                         0 1 1 = Mode 3 (square wave generator) (*)
@@ -53,20 +57,93 @@ void pit_init(void)
                         1 1 1 = Mode 3 (square wave generator, same as 011b)
 
         0            BCD/Binary mode:
-                        0 = 16-bit binary
-                        1 = four-digit BCD (*)
+                        0 = 16-bit binary (*)
+                        1 = four-digit BCD
 
-        Therefore, we are going to send 0011 0111 (0x37) to PIT Mode/Command register
+        Therefore, we send 0011 0000 (0x30) for the tickless one-shot, or 0011 0110 (0x36) for 100Hz periodic mode
     */
     // init_shell();
-    outb(0x37, PIT_CMD_REG); // 0x43
+    pit_calibrate_tsc();
+
+#if PIT_TICKLESS
+    // mode 0 is a one-shot: nothing happens until the scheduler arms it with pit_arm
+    outb(PIT_CMD_ONESHOT, PIT_CMD_REG); // 0x43
+#else
+    outb(PIT_CMD_PERIODIC, PIT_CMD_REG); // 0x43
 
     outb((uint8_t)_100HZ, PIT_CHNL_0_PORT);        // 0x40
-    outb((uint8_t)(_100HZ >> 8), PIT_CHNL_0_PORT); // 0x41
+    outb((uint8_t)(_100HZ >> 8), PIT_CHNL_0_PORT); // 0x40
+#endif
 
     enable_irq(PIT_IRQ);
 }
 
+/*
+ * pit_calibrate_tsc
+ * Description: count how many TSC cycles pass in one tick, using channel 2 so IRQ0 stays quiet
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: sets tsc_per_tick.
+ */
+static void pit_calibrate_tsc(void)
+{
+    uint64_t start;
+
+    // gate high, speaker off
+    outb((inb(PIT_CHNL_2_GATE_PORT) & ~PIT_SPEAKER_ENABLE) | PIT_CHNL_2_GATE, PIT_CHNL_2_GATE_PORT);
+
+    outb(PIT_CMD_CALIB, PIT_CMD_REG);
+    outb((uint8_t)_100HZ, PIT_CHNL_2_PORT);
+    outb((uint8_t)(_100HZ >> 8), PIT_CHNL_2_PORT);
+
+    // output goes high when the count reaches 0
+    start = rdtsc();
+    while ((inb(PIT_CHNL_2_GATE_PORT) & PIT_CHNL_2_OUT) == 0)
+        ;
+    tsc_per_tick = (uint32_t)(rdtsc() - start);
+
+    if (tsc_per_tick == 0)
+        tsc_per_tick = 1;
+}
+
+/*
+ * pit_arm
+ * Description: fire one interrupt after some ticks (tickless mode only)
+ *  Inputs: ticks -- clamped to 1 ~ PIT_MAX_ONESHOT_TICKS
+ *  Outputs: None
+ * Side Effects: replaces any pending one-shot.
+ */
+void pit_arm(uint32_t ticks)
+{
+#if PIT_TICKLESS
+    uint32_t count;
+
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > PIT_MAX_ONESHOT_TICKS)
+        ticks = PIT_MAX_ONESHOT_TICKS;
+    count = ticks * _100HZ;
+
+    outb(PIT_CMD_ONESHOT, PIT_CMD_REG);
+    outb((uint8_t)count, PIT_CHNL_0_PORT);
+    outb((uint8_t)(count >> 8), PIT_CHNL_0_PORT);
+#endif
+}
+
+/*
+ * pit_disarm
+ * Description: cancel the pending one-shot (tickless mode only)
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: writing the mode byte alone stops channel 0 until a new count is loaded.
+ */
+void pit_disarm(void)
+{
+#if PIT_TICKLESS
+    outb(PIT_CMD_ONESHOT, PIT_CMD_REG);
+#endif
+}
+
 /*
  * pit_int_handler
  * Description: pit interrupts
@@ -78,7 +155,6 @@ void pit_int_handler(void)
 {
     cli();
     send_eoi(PIT_IRQ);
-    change_vidmem_mapping(running_term_ptr->next_term_to_run->tid);
-    schedule();
+    sched_tick();
     sti();
 }
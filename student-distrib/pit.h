@@ -1,9 +1,29 @@
 #ifndef _PIT_H
 #define _PIT_H
 
+#include "types.h"
+
 #define PIT_IRQ 0
 #define _100HZ 11932
 
+/* 1: dynamic tick, channel 0 is a one-shot armed for the next deadline only
+ * 0: fixed 100Hz periodic interrupts */
+#define PIT_TICKLESS 1
+
+/* longest one-shot in ticks, the counter is 16 bits (5 * 11932 < 65536) */
+#define PIT_MAX_ONESHOT_TICKS 5
+
+/* mode/command bytes, see the table in pit_init */
+#define PIT_CMD_PERIODIC 0x36   // channel 0, lobyte/hibyte, mode 3, binary
+#define PIT_CMD_ONESHOT  0x30   // channel 0, lobyte/hibyte, mode 0, binary
+#define PIT_CMD_CALIB    0xB0   // channel 2, lobyte/hibyte, mode 0, binary
+
+/* port 0x61 controls the gate of channel 2 and reports its output */
+#define PIT_CHNL_2_GATE_PORT 0x61
+#define PIT_CHNL_2_GATE      0x01
+#define PIT_SPEAKER_ENABLE   0x02
+#define PIT_CHNL_2_OUT       0x20
+
 /*
     I/O port     Usage
     0x40         Channel 0 data port (read/write)
@@ -16,7 +36,11 @@
 #define PIT_CHNL_2_PORT 0x42
 #define PIT_CMD_REG     0x43    // Mode/Command register
 
+extern uint32_t tsc_per_tick; // TSC cycles in one 100Hz tick, measured at boot
+
 void pit_init(void);
 void pit_int_handler(void);
+void pit_arm(uint32_t ticks);
+void pit_disarm(void);
 
 #endif
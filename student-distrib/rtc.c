@@ -1,6 +1,9 @@
 #include "i8259.h"
 #include "lib.h"
 #include "rtc.h"
+#include "sched.h"
+
+static wait_queue_t rtc_wait_queue; // processes blocked in rtc_read
 
 
 /* rtc_init
@@ -15,6 +18,7 @@ void rtc_init(void)
     rtc_signal = 0;
     test_rtc = 0;
     interrupt_time_count = 0;
+    wait_queue_init(&rtc_wait_queue);
     uint8_t temp;
     temp = inb(RTC_PORT) | 0x80;  //0x80 is for set the first bit to 1
     outb(temp, RTC_PORT);         //write the value back to RTC port
@@ -49,6 +53,8 @@ void rtc_int_handler(void){
     outb(RTC_REG_C, RTC_PORT);  //select register C
     inb(CMOS_PORT);    //throw away the contents
     send_eoi(RTC_IRQ);
+    wake_up(&rtc_wait_queue);   //every reader waits for the same tick
+    sched_preempt();            //a woken reader may beat the current process
 
     sti();
 }
@@ -61,15 +67,20 @@ void rtc_int_handler(void){
  *         buf -- the pointer to the frequency number
  *         nbytes -- returned by the function if the frequency is set successfully
  * Outputs: 0 for success, -1 for failure
- * Side Effects: block until the interrupt status is changed
+ * Side Effects: sleep until the next RTC interrupt
  * Reference: OSdev
  */
 int32_t rtc_read(file_entry* fp, void* buf, int32_t nbytes){
     // printf("Enter rtc read\n");
     // rtc_pulse(-1);
+    uint32_t flags;
+    int tick;
+    cli_and_save(flags);
+    tick = interrupt_time_count;
+    while(interrupt_time_count == tick)
+        sleep_on(&rtc_wait_queue);
     rtc_signal = 0;
-    while(rtc_signal != 1);
-    rtc_signal = 0;
+    restore_flags(flags);
     return 0;
 
 }
@@ -0,0 +1,566 @@
+#include "sched.h"
+#include "syscall_handler.h"
+#include "terminal.h"
+#include "x86_desc.h"
+#include "lib.h"
+#include "pit.h"
+#include "fpu.h"
+
+/*
+ * O(1) scheduler. Every RUNNABLE process that is not on the CPU right now sits
+ * in the active array, in the FIFO list of its dynamic priority. A process
+ * whose time slice runs out moves to the expired array; once the active array
+ * is empty the two arrays are swapped. Picking the next process is a bit scan
+ * over the priority bitmap, so it costs the same however many processes exist.
+ * When nothing is runnable we fall back to the boot context, which becomes the
+ * idle task in sched_idle.
+ */
+typedef struct prio_array
+{
+    uint32_t nr_active;
+    uint32_t bitmap[PRIO_BITMAP_SIZE];
+    PCB_t *head[MAX_PRIO];
+    PCB_t *tail[MAX_PRIO];
+} prio_array_t;
+
+static prio_array_t prio_arrays[2];
+static prio_array_t *active_array = &(prio_arrays[0]);
+static prio_array_t *expired_array = &(prio_arrays[1]);
+
+static uint32_t expired_timestamp; // tick when the expired array became non-empty
+static int need_resched = 0;       // a process with a better priority than the current one woke up
+static int slice_armed = 0;        // the PIT one-shot holds the end of the current slice
+
+static uint32_t idle_esp; // kernel esp of the boot context while a process runs
+
+/* idle time accounting, in TSC cycles */
+static uint64_t boot_cycles;
+static uint64_t idle_since;
+static uint64_t idle_cycles;
+
+/*
+ * sched_clock
+ * Description: ticks since boot, read from the TSC so it keeps counting while the PIT is quiet
+ *  Inputs: None
+ *  Outputs: number of 100Hz ticks
+ * Side Effects: None.
+ */
+static uint32_t sched_clock(void)
+{
+    return div64_32(rdtsc() - boot_cycles, tsc_per_tick);
+}
+
+/*
+ * charge_current
+ * Description: take the ticks the current process ran since it was last charged off its slice
+ *  Inputs: PCB pointer
+ *  Outputs: None
+ * Side Effects: the part of a tick left over is carried to the next charge, so being
+ *               charged often (every wakeup of another process) does not make a CPU hog free.
+ */
+static void charge_current(PCB_t *pcb)
+{
+    uint64_t now = rdtsc();
+    uint32_t used;
+
+    pcb->run_cycles += now - pcb->run_start;
+    pcb->run_start = now;
+    used = div64_32(pcb->run_cycles, tsc_per_tick);
+    pcb->run_cycles -= (uint64_t)used * tsc_per_tick;
+
+    pcb->counts -= min(used, pcb->counts);
+    pcb->sleep_avg -= min(used, pcb->sleep_avg);
+}
+
+/*
+ * arm_slice_timer
+ * Description: program the PIT for the end of the current time slice, if anything
+ *              else could use the CPU then; otherwise leave it quiet
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void arm_slice_timer(void)
+{
+    if (cur_pcb_ptr != NULL && (active_array->nr_active != 0 || expired_array->nr_active != 0))
+    {
+        charge_current(cur_pcb_ptr);
+        pit_arm(cur_pcb_ptr->counts);
+        slice_armed = 1;
+    }
+    else
+    {
+        pit_disarm();
+        slice_armed = 0;
+    }
+}
+
+/*
+ * prio_array_push
+ * Description: put a process at the tail of the list of its priority
+ *  Inputs: priority array, PCB pointer
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void prio_array_push(prio_array_t *array, PCB_t *pcb)
+{
+    int32_t prio = pcb->prio;
+
+    pcb->next_run = NULL;
+    if (array->tail[prio] == NULL)
+        array->head[prio] = pcb;
+    else
+        array->tail[prio]->next_run = pcb;
+    array->tail[prio] = pcb;
+
+    array->bitmap[prio >> 5] |= 1 << (prio & 31);
+    array->nr_active++;
+}
+
+/*
+ * prio_array_pop
+ * Description: take the first process of the best non-empty priority
+ *  Inputs: priority array
+ *  Outputs: PCB pointer, NULL if the array is empty
+ * Side Effects: None.
+ */
+static PCB_t *prio_array_pop(prio_array_t *array)
+{
+    int32_t i;
+    int32_t prio;
+    PCB_t *pcb;
+
+    for (i = 0; i < PRIO_BITMAP_SIZE; i++)
+    {
+        if (array->bitmap[i] != 0)
+            break;
+    }
+    if (i == PRIO_BITMAP_SIZE)
+        return NULL;
+
+    asm volatile("bsfl %1, %0" : "=r"(prio) : "rm"(array->bitmap[i]));
+    prio += i << 5;
+
+    pcb = array->head[prio];
+    array->head[prio] = pcb->next_run;
+    if (array->head[prio] == NULL)
+    {
+        array->tail[prio] = NULL;
+        array->bitmap[prio >> 5] &= ~(1 << (prio & 31));
+    }
+    array->nr_active--;
+
+    pcb->next_run = NULL;
+    return pcb;
+}
+
+/*
+ * effective_prio
+ * Description: static priority adjusted by how much the process sleeps,
+ *              so interactive processes beat CPU hogs of the same nice value
+ *  Inputs: PCB pointer
+ *  Outputs: dynamic priority, 0 is the best
+ * Side Effects: None.
+ */
+static int32_t effective_prio(PCB_t *pcb)
+{
+    int32_t bonus = (int32_t)(pcb->sleep_avg * MAX_BONUS / MAX_SLEEP_AVG) - MAX_BONUS / 2;
+    int32_t prio = pcb->static_prio - bonus;
+
+    if (prio < 0)
+        prio = 0;
+    if (prio > MAX_PRIO - 1)
+        prio = MAX_PRIO - 1;
+    return prio;
+}
+
+/*
+ * sched_init_pcb
+ * Description: give a new process its priority and first time slice
+ *  Inputs: PCB pointer, static priority
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void sched_init_pcb(PCB_t *pcb, int32_t static_prio)
+{
+    pcb->static_prio = static_prio;
+    pcb->sleep_avg = 0;
+    pcb->prio = effective_prio(pcb);
+    pcb->counts = TIME_SLICE(static_prio);
+    pcb->run_cycles = 0;
+}
+
+/*
+ * sched_set_nice
+ * Description: change the static priority of a process
+ *  Inputs: PCB pointer, nice value (-20 ~ 19)
+ *  Outputs: None
+ * Side Effects: takes effect when the process is queued next time.
+ */
+void sched_set_nice(PCB_t *pcb, int32_t nice)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    pcb->static_prio = NICE_TO_PRIO(nice);
+    if (pcb == cur_pcb_ptr)
+    {
+        pcb->prio = effective_prio(pcb);
+        need_resched = 1; // somebody queued may be better now
+    }
+    restore_flags(flags);
+}
+
+/*
+ * sched_enqueue
+ * Description: put a process into the active array
+ *  Inputs: PCB pointer
+ *  Outputs: None
+ * Side Effects: arms the PIT if the current process was alone, an armed slice is left as it is.
+ */
+void sched_enqueue(PCB_t *pcb)
+{
+    pcb->flag = RUNNABLE;
+    prio_array_push(active_array, pcb);
+    if (!slice_armed)
+        arm_slice_timer(); // the current process was alone, now its slice matters
+}
+
+/*
+ * sched_wakeup
+ * Description: make a suspended process runnable again
+ *  Inputs: PCB pointer
+ *  Outputs: None
+ * Side Effects: must be called with interrupts disabled.
+ */
+void sched_wakeup(PCB_t *pcb)
+{
+    if (pcb->flag != SUSPENDED)
+        return;
+
+    // credit the time spent asleep, this is what makes a process interactive
+    pcb->sleep_avg += sched_clock() - pcb->sleep_start;
+    if (pcb->sleep_avg > MAX_SLEEP_AVG)
+        pcb->sleep_avg = MAX_SLEEP_AVG;
+    pcb->prio = effective_prio(pcb);
+
+    sched_enqueue(pcb);
+
+    if (cur_pcb_ptr == NULL || pcb->prio < cur_pcb_ptr->prio)
+        need_resched = 1;
+}
+
+/*
+ * sched_block
+ * Description: suspend the current process until sched_wakeup is called on it
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: must be called with interrupts disabled, returns with them disabled.
+ */
+void sched_block(void)
+{
+    cur_pcb_ptr->flag = SUSPENDED;
+    cur_pcb_ptr->sleep_start = sched_clock();
+    schedule();
+}
+
+/*
+ * sched_tick
+ * Description: PIT interrupt, the time slice of the running process may be over
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: must be called with interrupts disabled.
+ */
+void sched_tick(void)
+{
+    PCB_t *pcb = cur_pcb_ptr;
+
+    slice_armed = 0; // the one-shot fired
+
+    if (pcb == NULL)
+    {
+        // idle, switch only if an interrupt woke somebody up
+        if (need_resched)
+            schedule();
+        return;
+    }
+
+    charge_current(pcb);
+    if (pcb->counts > 0)
+    {
+        if (need_resched)
+            schedule();
+        else
+            arm_slice_timer(); // slice longer than one one-shot, keep going
+        return;
+    }
+
+    // time slice used up: new priority and slice, interactive processes may stay in the active array
+    pcb->prio = effective_prio(pcb);
+    pcb->counts = TIME_SLICE(pcb->static_prio);
+
+    if (pcb->static_prio - pcb->prio >= INTERACTIVE_DELTA &&
+        (expired_array->nr_active == 0 || sched_clock() - expired_timestamp < STARVATION_LIMIT))
+    {
+        pcb->flag = RUNNABLE;
+    }
+    else
+    {
+        pcb->flag = EXPIRED;
+    }
+
+    schedule();
+}
+
+/*
+ * sched_preempt
+ * Description: switch right away if an interrupt handler woke up a better process
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: call at the end of interrupt handlers, with interrupts disabled.
+ */
+void sched_preempt(void)
+{
+    if (need_resched)
+        schedule();
+}
+
+/*
+ * pick_next
+ * Description: take the best runnable process, swapping the arrays when the active one is empty
+ *  Inputs: None
+ *  Outputs: PCB pointer, NULL if nothing is runnable
+ * Side Effects: None.
+ */
+static PCB_t *pick_next(void)
+{
+    prio_array_t *tmp;
+
+    if (active_array->nr_active == 0 && expired_array->nr_active != 0)
+    {
+        tmp = active_array;
+        active_array = expired_array;
+        expired_array = tmp;
+    }
+
+    return prio_array_pop(active_array);
+}
+
+/*
+ * schedule
+ * Description: switch to the best runnable process
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: must be called with interrupts disabled.
+ */
+void schedule(void)
+{
+    PCB_t *prev_pcb_ptr = cur_pcb_ptr;
+    PCB_t *next_pcb_ptr;
+    uint32_t *prev_esp;
+
+    need_resched = 0;
+
+    //================== put "current" back to the run queue =======================
+
+    if (prev_pcb_ptr != NULL)
+        charge_current(prev_pcb_ptr);
+
+    if (prev_pcb_ptr != NULL && prev_pcb_ptr->flag == RUNNABLE)
+    {
+        prio_array_push(active_array, prev_pcb_ptr);
+    }
+    else if (prev_pcb_ptr != NULL && prev_pcb_ptr->flag == EXPIRED)
+    {
+        if (expired_array->nr_active == 0)
+            expired_timestamp = sched_clock();
+        prio_array_push(expired_array, prev_pcb_ptr);
+    }
+
+    next_pcb_ptr = pick_next();
+    if (next_pcb_ptr != NULL)
+    {
+        next_pcb_ptr->flag = RUNNABLE;
+        next_pcb_ptr->run_start = rdtsc();
+    }
+    if (next_pcb_ptr == prev_pcb_ptr)
+    {
+        if (!slice_armed)
+            arm_slice_timer(); // same slice, unless the tick that got us here ended it
+        return;
+    }
+
+    if (prev_pcb_ptr == NULL)
+    {
+        prev_esp = &idle_esp;
+        idle_cycles += rdtsc() - idle_since;
+    }
+    else
+    {
+        prev_esp = &(prev_pcb_ptr->esp);
+    }
+
+    //================== nothing runnable, go back to the idle task =======================
+
+    if (next_pcb_ptr == NULL)
+    {
+        cur_pcb_ptr = NULL;
+        cur_pid = -1;
+        idle_since = rdtsc();
+        fpu_switch_to(NULL);
+        arm_slice_timer();
+        // CR3 keeps the last page directory, the idle task only touches kernel memory
+        // and a halting process already switched to page_dir_base before freeing its own
+        switch_context(prev_esp, idle_esp);
+        return;
+    }
+
+    //================== update "current" info =======================
+
+    cur_pcb_ptr = next_pcb_ptr;
+    cur_pid = next_pcb_ptr->pid;
+
+    if (running_term_ptr != next_pcb_ptr->term)
+    {
+        running_term_ptr = next_pcb_ptr->term;
+        change_vidmem_mapping(running_term_ptr->tid);
+    }
+
+    //================== set up new process paging =======================
+
+    setup_paging_and_flush_tlb(next_pcb_ptr->pid);
+
+    //================== restore next program's kernel stack =======================
+
+    tss.ss0 = KERNEL_DS;
+    tss.esp0 = next_pcb_ptr->tss_esp0;
+
+    fpu_switch_to(next_pcb_ptr);
+    arm_slice_timer();
+    switch_context(prev_esp, next_pcb_ptr->esp);
+}
+
+/*
+ * sched_init
+ * Description: start the scheduler clock, call after pit_init has calibrated the TSC
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void sched_init(void)
+{
+    boot_cycles = rdtsc();
+    idle_since = boot_cycles;
+}
+
+/*
+ * sched_idle
+ * Description: the idle task, run by the boot context whenever the run queue is empty
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: never returns.
+ */
+void sched_idle(void)
+{
+    for (;;)
+    {
+        cli();
+        // an interrupt handler may have woken somebody up, run it right away
+        if (active_array->nr_active != 0 || expired_array->nr_active != 0)
+            schedule();
+
+        // sti only takes effect after the next instruction, so no interrupt sneaks in before hlt
+        asm volatile("sti; hlt" : : : "memory");
+    }
+}
+
+/*
+ * sched_get_cycles
+ * Description: report how much CPU time has passed and how much of it was idle
+ *  Inputs: where to store the total and the idle cycles since boot
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void sched_get_cycles(uint64_t *total, uint64_t *idle)
+{
+    uint32_t flags;
+    uint64_t now;
+
+    cli_and_save(flags);
+    now = rdtsc();
+    *total = now - boot_cycles;
+    *idle = idle_cycles;
+    if (cur_pcb_ptr == NULL)
+        *idle += now - idle_since;
+    restore_flags(flags);
+}
+
+/*
+ * wait_queue_init
+ * Description: initialize an empty wait queue
+ *  Inputs: wait queue pointer
+ *  Outputs: None
+ * Side Effects: None.
+ */
+void wait_queue_init(wait_queue_t *wq)
+{
+    wq->head = NULL;
+}
+
+/*
+ * sleep_on
+ * Description: block the current process until wake_up is called on the queue.
+ *              The caller should disable interrupts, check its condition and call
+ *              this in a loop, so that a wake up between the check and the sleep is not lost.
+ *  Inputs: wait queue pointer
+ *  Outputs: None
+ * Side Effects: the interrupt flag of the caller is restored on return. The node lives
+ *               on this stack, so it is off the queue however the process was woken.
+ */
+void sleep_on(wait_queue_t *wq)
+{
+    wait_queue_node_t node;
+    wait_queue_node_t **link;
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    node.pcb = cur_pcb_ptr;
+    node.next = wq->head;
+    wq->head = &node;
+
+    sched_block();
+
+    // wake_up empties the queue, a direct sched_wakeup leaves the node behind
+    for (link = &(wq->head); *link != NULL; link = &((*link)->next))
+    {
+        if (*link == &node)
+        {
+            *link = node.next;
+            break;
+        }
+    }
+
+    restore_flags(flags);
+}
+
+/*
+ * wake_up
+ * Description: make every process sleeping on the queue runnable
+ *  Inputs: wait queue pointer
+ *  Outputs: None
+ * Side Effects: the woken processes run at their next turn in the run queue.
+ */
+void wake_up(wait_queue_t *wq)
+{
+    wait_queue_node_t *node;
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    for (node = wq->head; node != NULL; node = node->next)
+        sched_wakeup(node->pcb);
+    wq->head = NULL;
+
+    restore_flags(flags);
+}
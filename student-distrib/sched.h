@@ -0,0 +1,78 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+#include "syscall_handler.h"
+
+#define USER_EFLAGS 0x200 // IF set, everything else cleared
+
+/* priorities: 0 is the best, nice -20 ~ 19 maps to 0 ~ 39 */
+#define MAX_PRIO 40
+#define PRIO_BITMAP_SIZE ((MAX_PRIO + 31) / 32)
+#define MIN_NICE (-20)
+#define MAX_NICE 19
+#define NICE_TO_PRIO(nice) ((nice) + 20)
+#define DEFAULT_PRIO NICE_TO_PRIO(0)
+
+/* time slice in PIT ticks: 10 for nice -20, 5 for nice 0, 1 for nice 19 */
+#define TIME_SLICE(static_prio) (1 + (MAX_PRIO - 1 - (static_prio)) / 4)
+
+/* interactivity: sleeping earns up to MAX_BONUS / 2 priority levels, running costs them back */
+#define MAX_SLEEP_AVG 100     // in PIT ticks
+#define MAX_BONUS 10
+#define INTERACTIVE_DELTA 2   // bonus that keeps a process in the active array when its slice ends
+#define STARVATION_LIMIT 100  // ticks the expired array may wait before interactive processes stop cutting in
+
+#ifndef ASM
+
+// a process sleeping on a wait queue, lives on the sleeper's own kernel stack
+typedef struct wait_queue_node
+{
+    PCB_t *pcb;
+    struct wait_queue_node *next;
+} wait_queue_node_t;
+
+// processes blocked until some event (an interrupt, usually) happens
+typedef struct wait_queue
+{
+    wait_queue_node_t *head;
+} wait_queue_t;
+
+/* =========================== function declarations =========================== */
+
+// start the scheduler clock
+extern void sched_init(void);
+// set up priority and time slice of a new process
+extern void sched_init_pcb(PCB_t *pcb, int32_t static_prio);
+// change the nice value of a process
+extern void sched_set_nice(PCB_t *pcb, int32_t nice);
+// put a runnable process into the active array
+extern void sched_enqueue(PCB_t *pcb);
+// mark a suspended process runnable again
+extern void sched_wakeup(PCB_t *pcb);
+// give up the CPU until someone calls sched_wakeup on us
+extern void sched_block(void);
+// charge the running process a PIT tick, switch when its time slice is over
+extern void sched_tick(void);
+// switch now if an interrupt woke a process better than the current one
+extern void sched_preempt(void);
+// pick the next process and switch to it
+extern void schedule(void);
+// loop forever halting the CPU, the scheduler falls back to this when nothing is runnable
+extern void sched_idle(void);
+// cycles since boot, and how many of them were spent in the idle task
+extern void sched_get_cycles(uint64_t *total, uint64_t *idle);
+
+extern void wait_queue_init(wait_queue_t *wq);
+// block the current process on a wait queue, call it in a loop re-checking the condition
+extern void sleep_on(wait_queue_t *wq);
+// make every process sleeping on a wait queue runnable, safe to call from interrupt handlers
+extern void wake_up(wait_queue_t *wq);
+
+// this is in ASM file
+extern void switch_context(uint32_t *prev_esp, uint32_t next_esp);
+extern void process_entry(void);
+extern void fork_return(void);
+
+#endif /* ASM */
+#endif /* _SCHED_H */
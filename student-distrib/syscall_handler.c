@@ -5,13 +5,25 @@
 #include "x86_desc.h"
 #include "lib.h"
 #include "rtc.h"
+#include "sched.h"
+#include "fpu.h"
+#include "mm.h"
+#include "kmalloc.h"
+#include "image.h"
+#include "vm.h"
+#include "bcache.h"
+#include "dcache.h"
 
 // int usr_programs_remaining = 3;     // decrement every usr programs (also shells but not base shells)
 int cur_pid = -1; // scheduler should control this!
 PCB_t *cur_pcb_ptr = NULL;
 // int8_t args[3][50];                 // 3 user argument buffers
 // int8_t command[3][50];              // 3 command buffers
-int8_t pcb_bitmap[MAX_NUM_PROCESS] = {0, 0, 0, 0, 0, 0};
+PCB_t *pcb_table[PID_MAX];             // NULL for pids not in use
+
+static int16_t pid_free_list[PID_MAX]; // next free pid, -1 ends the list
+static int32_t pid_free_head = -1;
+static int32_t pending_free_pid = -1;  // halted process whose kernel stack was still in use
 
 // extern int32_t ece391_execute(uint8_t *command);
 
@@ -116,6 +128,9 @@ int32_t syscall_close(int32_t fd)
     if (cur_pcb_ptr->pcb_fds[fd].flags == FREE)
         return -1;
 
+    file_ops_t *ops;
+    ops = (file_ops_t *)cur_pcb_ptr->pcb_fds[fd].op_ptr;
+    ops->close(&(cur_pcb_ptr->pcb_fds[fd]));
     cur_pcb_ptr->pcb_fds[fd].flags = FREE; // Free this file descriptor entry.
     return 0;
 }
@@ -178,7 +193,7 @@ int32_t syscall_vidmap(uint8_t **screen_start)
 {
     if (screen_start == NULL)
         return -1;
-    if ((int32_t)screen_start < USER_START || (int32_t)screen_start > (USER_END - 4))
+    if (!vm_user_range(screen_start, sizeof(uint8_t *)))
     {
         printf("Invalid requirement of vidmap!\n");
         return -1;
@@ -189,7 +204,6 @@ int32_t syscall_vidmap(uint8_t **screen_start)
     else
         switch_usrmap(VIDEO >> 12, 1);
 
-    flush_tlb();
     *screen_start = (uint8_t *)(FISH_MAP);
     cur_pcb_ptr->vidmap_flag = 1;
     running_term_ptr->vidmap_flag = 1;
@@ -201,8 +215,8 @@ int32_t syscall_vidmap(uint8_t **screen_start)
 /* syscall_execute
  *
  * Inputs: -user_input
- * Outputs: 0 for success, -1 for failure
- * Side Effects: perform execute
+ * Outputs: exit status of the program, 0 for a background job, -1 for failure
+ * Side Effects: perform execute, a trailing '&' runs the program in the background
  * Reference: OSdev
  */
 int32_t syscall_execute(const uint8_t *user_input)
@@ -211,23 +225,13 @@ int32_t syscall_execute(const uint8_t *user_input)
     cli();
 
     // declare local variables here
-    int8_t first_four_bytes[4];
     dentry_t the_file_dentry;
     int8_t args[ARG_LEN];
     int8_t file_name[FNAME_MAX_LEN + 1];
-    int read_result;
+    uint8_t detached;
     int new_pid;
-
-    int8_t *program_img_addr_virtual;
-    int32_t addr_of_that_inode;
-    inode_t *inode_ptr;
-    int i;
     PCB_t *new_pcb_ptr;
-
-    uint8_t *entry;
-    uint32_t user_eip;
-
-    uint32_t new_process_addr;
+    int32_t retval;
 
     /* ==================================== sanity check ==================================== */
 
@@ -239,25 +243,12 @@ int32_t syscall_execute(const uint8_t *user_input)
     if (-1 == parse_args((int8_t *)user_input, file_name, args))
         return -1;
 
+    detached = parse_background(file_name, args);
+
     /* ==================================== check ELF ==================================== */
 
-    if (read_dentry_by_name((int8_t *)file_name, &the_file_dentry) == -1)
-    {
-        printf("read_by_name fails\n");
+    if (-1 == check_program(file_name, &the_file_dentry))
         return -1;
-    }
-
-    read_result = read_data(the_file_dentry.nr_inode, 0, first_four_bytes, 4);
-
-    if (-1 == read_result ||
-        first_four_bytes[0] != 0x7F ||
-        first_four_bytes[1] != 0x45 ||
-        first_four_bytes[2] != 0x4c ||
-        first_four_bytes[3] != 0x46)
-    {
-        printf("Checking ELF fails\n");
-        return -1;
-    }
 
     /* ==================================== create new process ==================================== */
     new_pid = record_process();
@@ -267,69 +258,30 @@ int32_t syscall_execute(const uint8_t *user_input)
         return 0;
     }
 
-    /* ==================================== set up paging ==================================== */
-
-    setup_paging_and_flush_tlb(new_pid);
+    if (-1 == create_process(new_pid, &the_file_dentry, args, cur_pcb_ptr->term, cur_pid, detached))
+    {
+        printf("Out of memory!\n");
+        decord_process(new_pid);
+        return -1;
+    }
 
-    /* ==================================== load user file ==================================== */
+    if (detached)
+        return 0;
 
-    program_img_addr_virtual = (int8_t *)PROGRAM_VIR_ADDR; // RTDC
-    addr_of_that_inode = inode_start + the_file_dentry.nr_inode * BLOCK_SIZE;
-    inode_ptr = (inode_t *)(addr_of_that_inode);
-    read_data(the_file_dentry.nr_inode, 0, program_img_addr_virtual, inode_ptr->length);
+    /* ==================================== wait for the child ==================================== */
 
-    /* ==================================== initiaize PCB ==================================== */
     new_pcb_ptr = get_pcb_ptr(new_pid);
-    new_pcb_ptr->pid = new_pid;
-    new_pcb_ptr->parent_pid = cur_pid;
-    new_pcb_ptr->vidmap_flag = 0;
-    init_file_table(new_pcb_ptr);
-
-    new_process_addr = (uint32_t)new_pcb_ptr;
-    new_pcb_ptr->tss_esp0 = new_process_addr + _8K - 4;
-
-    for (i = 2; i < 8; i++)
-        new_pcb_ptr->pcb_fds[i].flags = FREE;
-
-    strncpy(new_pcb_ptr->args, args, ARG_LEN);
-
-    /* ==================================== context switch to user ==================================== */
-
-    // save current info
-    if (cur_pid != -1)
+    while (new_pcb_ptr->flag != ZOMBIE)
     {
-        asm volatile(
-            "movl %%esp, %0 \n\t"
-            "movl %%ebp, %1 \n\t"
-            : "=r"(cur_pcb_ptr->esp), "=r"(cur_pcb_ptr->ebp));
+        cur_pcb_ptr->wait_child = 1;
+        sched_block();
     }
 
-    // update current info
-    cur_pcb_ptr = new_pcb_ptr;
-    cur_pid = new_pid;
-
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = new_pcb_ptr->tss_esp0;
-
-    // iret!
-    entry = (uint8_t *)PROGRAM_VIR_ADDR + 24;
-    user_eip = *(uint32_t *)entry;
-
-    sti();
-    asm volatile(
-        "pushl %%eax        \n\t"
-        "pushl %%ebx        \n\t"
-        "pushfl             \n\t"
-        "pushl %%ecx        \n\t"
-        "pushl %%edx        \n\t"
-        "iret               \n\t"
-        :
-        : "a"(USER_DS), "b"(_128M + _4M - 4), "c"(USER_CS), "d"(user_eip)
-        : "cc", "memory");
+    retval = new_pcb_ptr->exit_status;
+    new_pcb_ptr->flag = NONE;
+    decord_process(new_pid);
 
-    // this return will never be executed
-    printf("You reach execute's return!\n");
-    return 0;
+    return retval;
 }
 
 /* syscall_halt
@@ -345,30 +297,7 @@ int32_t syscall_halt(uint8_t status)
 
     // declare local variables here
     int i;
-    PCB_t *parent_pcb_ptr;
-    uint16_t retval;
-
-    /* ==================================== deallocate pid ==================================== */
-
-    decord_process(cur_pid);
-
-    /* ==================================== restore parent data ==================================== */
-
-    if (cur_pcb_ptr->parent_pid == -1)
-    {
-        cur_pid = -1;
-        syscall_execute((uint8_t *)"shell");
-        printf("This should not be printed!\n");
-    }
-
-    parent_pcb_ptr = get_pcb_ptr(cur_pcb_ptr->parent_pid);
-
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = parent_pcb_ptr->tss_esp0;
-
-    /* ==================================== restore parent paging ==================================== */
-
-    setup_paging_and_flush_tlb(cur_pcb_ptr->parent_pid);
+    PCB_t *parent;
 
     /* ==================================== close any relevant FDs ==================================== */
 
@@ -387,26 +316,43 @@ int32_t syscall_halt(uint8_t status)
             switch_usrmap(running_term_ptr->vid_mem_buffer >> 12, 0); // map to buffer, close page
     }
 
-    /* ==================================== modify "current" info ==================================== */
+    fpu_release(cur_pcb_ptr);
+    vm_release(cur_pcb_ptr);
+    orphan_children(cur_pid);
 
-    cur_pid = cur_pcb_ptr->parent_pid;
-    cur_pcb_ptr = parent_pcb_ptr;
+    /* ==================================== base shell never dies ==================================== */
 
-    /* ==================================== jump to execute return ==================================== */
+    if (cur_pcb_ptr->parent_pid == -1)
+    {
+        restart_base_shell();
+        printf("Cannot restart the base shell!\n");
+    }
 
-    retval = (status == 255) ? 256 : (uint16_t)status;
+    /* ==================================== hand the status to the parent ==================================== */
 
-    asm volatile(
-        "movl %0, %%esp     \n\t"
-        "movl %1, %%ebp     \n\t"
-        "movl $0, %%eax     \n\t"
-        "movw %2, %%ax      \n\t"
-        "leave              \n\t"
-        "ret                \n\t"
-        :
-        : "r"(parent_pcb_ptr->esp), "r"(parent_pcb_ptr->ebp), "r"(retval)
-        : "esp", "ebp", "eax");
+    if (cur_pcb_ptr->detached || cur_pcb_ptr->parent_pid == -1)
+    {
+        // nobody is waiting, give the pid back right away
+        cur_pcb_ptr->flag = NONE;
+        decord_process(cur_pid);
+    }
+    else
+    {
+        cur_pcb_ptr->exit_status = (status == 255) ? 256 : (uint16_t)status;
+        cur_pcb_ptr->flag = ZOMBIE;
+        // a parent blocked in rtc_read or terminal_read sleeps on a wait queue, leave it there
+        parent = get_pcb_ptr(cur_pcb_ptr->parent_pid);
+        if (parent->wait_child)
+        {
+            parent->wait_child = 0;
+            sched_wakeup(parent);
+        }
+    }
 
+    schedule();
+
+    // this return will never be executed
+    printf("This should not be printed!\n");
     return 0;
 }
 
@@ -436,60 +382,444 @@ int32_t syscall_sigreturn(void)
     return -1;
 }
 
-// above: 10 syscalls
+/* syscall_sysinfo
+ *
+ * Inputs: info -- user struct to fill in
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: report CPU time and idle time since boot, memory and kernel heap usage, block and dentry cache hits and misses
+ * Reference: OSdev
+ */
+int32_t syscall_sysinfo(sysinfo_t *info)
+{
+    kmalloc_stats_t heap;
+    bcache_stats_t bcache;
+    dcache_stats_t dcache;
+
+    if (!vm_user_range(info, sizeof(sysinfo_t)))
+        return -1;
+
+    sched_get_cycles(&(info->total_cycles), &(info->idle_cycles));
+
+    kmalloc_get_stats(&heap);
+    info->total_frames = mm_nr_total_frames();
+    info->free_frames = mm_nr_free_frames();
+    info->heap_bytes = heap.heap_bytes;
+    info->heap_used = heap.used_bytes;
+    info->heap_allocs = heap.nr_allocs;
+    info->heap_frees = heap.nr_frees;
+
+    bcache_get_stats(&bcache);
+    info->bcache_hits = bcache.hits;
+    info->bcache_misses = bcache.misses;
+
+    dcache_get_stats(&dcache);
+    info->dcache_hits = dcache.hits;
+    info->dcache_misses = dcache.misses;
+    return 0;
+}
+
+/* syscall_setpriority
+ *
+ * Inputs: pid -- process to change, negative for the calling process
+ *         nice -- new nice value, -20 (best) ~ 19 (worst)
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: change the priority and time slice of the process
+ * Reference: OSdev
+ */
+int32_t syscall_setpriority(int32_t pid, int32_t nice)
+{
+    PCB_t *pcb_ptr;
+
+    if (nice < MIN_NICE || nice > MAX_NICE)
+        return -1;
+
+    if (pid < 0)
+        pcb_ptr = cur_pcb_ptr;
+    else if (pid < PID_MAX && pcb_table[pid] != NULL)
+        pcb_ptr = pcb_table[pid];
+    else
+        return -1;
+
+    sched_set_nice(pcb_ptr, nice);
+    return 0;
+}
+
+/* syscall_fork
+ *
+ * Inputs: none
+ * Outputs: pid of the child in the parent, 0 in the child, -1 for failure
+ * Side Effects: the child shares every page of the parent copy-on-write, and
+ *               resumes from the same syscall frame
+ * Reference: OSdev
+ */
+int32_t syscall_fork(void)
+{
+    PCB_t *parent = cur_pcb_ptr;
+    PCB_t *child;
+    int32_t child_pid;
+    uint32_t *parent_frame, *stack;
+    int i;
+
+    cli();
+
+    child_pid = record_process();
+    if (child_pid == -1)
+        return -1;
+    child = get_pcb_ptr(child_pid);
+
+    if (-1 == vm_fork(parent, child))
+    {
+        decord_process(child_pid);
+        return -1;
+    }
+    if (-1 == fpu_fork(parent, child))
+    {
+        vm_release(child);
+        decord_process(child_pid);
+        return -1;
+    }
+
+    child->pid = child_pid;
+    child->parent_pid = cur_pid;
+    child->vidmap_flag = 0;
+    child->detached = 0;
+    child->wait_child = 0;
+    child->exit_status = 0;
+    child->term = parent->term;
+    sched_init_pcb(child, parent->static_prio);
+    memcpy(child->pcb_fds, parent->pcb_fds, sizeof(parent->pcb_fds));
+    for (i = 2; i < 8; i++)
+    {
+        // the child closes its copies on its own
+        if (child->pcb_fds[i].flags == IN_USE && child->pcb_fds[i].op_ptr == (uint32_t)&regular_file_ops)
+            fs_inode_get(child->pcb_fds[i].inode, 0);
+    }
+    memcpy(child->args, parent->args, ARG_LEN);
+
+    child->tss_esp0 = (uint32_t)child + _8K - 4;
+
+    // copy the parent's syscall frame: iret frame, then the 9 registers syscall_entry saved
+    parent_frame = (uint32_t *)parent->tss_esp0 - SYSCALL_FRAME_WORDS;
+    stack = (uint32_t *)child->tss_esp0 - SYSCALL_FRAME_WORDS;
+    memcpy(stack, parent_frame, SYSCALL_FRAME_WORDS * sizeof(uint32_t));
+
+    // then what switch_context pops
+    *(--stack) = (uint32_t)fork_return;
+    for (i = 0; i < 4; i++)
+        *(--stack) = 0; // ebp, ebx, esi, edi
+    child->esp = (uint32_t)stack;
+
+    sched_enqueue(child);
+    return child_pid;
+}
+
+/* syscall_wait
+ *
+ * Inputs: status -- where to store the exit status of the child, may be NULL
+ * Outputs: pid of a halted child, -1 if the caller has no children to wait for
+ * Side Effects: blocks until a child created by fork halts
+ * Reference: OSdev
+ */
+int32_t syscall_wait(int32_t *status)
+{
+    PCB_t *child;
+    int32_t pid;
+    int32_t has_child;
+
+    cli();
+
+    if (status != NULL && !vm_user_range(status, sizeof(int32_t)))
+        return -1;
+
+    for (;;)
+    {
+        has_child = 0;
+        for (pid = 0; pid < PID_MAX; pid++)
+        {
+            child = pcb_table[pid];
+            if (child == NULL || pid == cur_pid || child->parent_pid != cur_pid || child->detached)
+                continue;
+
+            has_child = 1;
+            if (child->flag == ZOMBIE)
+            {
+                if (status != NULL)
+                    *status = child->exit_status;
+                child->flag = NONE;
+                decord_process(pid);
+                return pid;
+            }
+        }
+
+        if (!has_child)
+            return -1;
+        cur_pcb_ptr->wait_child = 1;
+        sched_block();
+    }
+}
+
+/* syscall_create
+ *
+ * Inputs: filename -- name of the new file, at most 32 characters
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: adds an empty regular file, it lasts until reboot
+ */
+int32_t syscall_create(const uint8_t *filename)
+{
+    if (filename == NULL)
+        return -1;
+    return fs_create((int8_t *)filename);
+}
+
+/* syscall_unlink
+ *
+ * Inputs: filename -- a regular file
+ * Outputs: 0 for success, -1 for failure (no such file, or a process runs it)
+ * Side Effects: the name goes away now, the data when the last fd or mapping of it is closed
+ */
+int32_t syscall_unlink(const uint8_t *filename)
+{
+    if (filename == NULL)
+        return -1;
+    return fs_unlink((int8_t *)filename);
+}
+
+/* syscall_truncate
+ *
+ * Inputs: filename -- a regular file
+ *         length -- new length in bytes
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: a longer file reads zeros past its old end
+ */
+int32_t syscall_truncate(const uint8_t *filename, uint32_t length)
+{
+    if (filename == NULL)
+        return -1;
+    return fs_truncate((int8_t *)filename, length);
+}
+
+/* syscall_getdents
+ *
+ * Inputs: fd -- an open directory
+ *         buf -- room for records of dirent_t
+ *         nbytes -- size of buf
+ * Outputs: bytes filled, a multiple of sizeof(dirent_t), 0 at the end of the directory, -1 for failure
+ * Side Effects: reads as many entries as fit, with their type, inode and size
+ */
+int32_t syscall_getdents(int32_t fd, dirent_t *buf, uint32_t nbytes)
+{
+    if (fd < 2 || fd > 7)
+        return -1;
+
+    if (cur_pcb_ptr->pcb_fds[fd].flags == FREE || cur_pcb_ptr->pcb_fds[fd].op_ptr != (uint32_t)&dir_ops)
+        return -1;
+
+    if (!vm_user_range(buf, nbytes))
+        return -1;
+
+    return dir_getdents(&(cur_pcb_ptr->pcb_fds[fd]), buf, nbytes);
+}
+
+/* syscall_fstat
+ *
+ * Inputs: fd -- an open file, directory or rtc
+ *         st -- filled with the type, inode and size in bytes
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: None
+ */
+int32_t syscall_fstat(int32_t fd, fs_stat_t *st)
+{
+    if (fd < 2 || fd > 7)
+        return -1;
+
+    if (cur_pcb_ptr->pcb_fds[fd].flags == FREE)
+        return -1;
+
+    if (!vm_user_range(st, sizeof(fs_stat_t)))
+        return -1;
+
+    return fs_fstat(&(cur_pcb_ptr->pcb_fds[fd]), st);
+}
+
+/* syscall_lseek
+ *
+ * Inputs: fd -- an open regular file
+ *         offset, whence -- SEEK_SET, SEEK_CUR or SEEK_END
+ * Outputs: the new position, -1 for failure
+ * Side Effects: the next read or write of fd starts there
+ */
+int32_t syscall_lseek(int32_t fd, int32_t offset, int32_t whence)
+{
+    if (fd < 2 || fd > 7)
+        return -1;
+
+    if (cur_pcb_ptr->pcb_fds[fd].flags == FREE)
+        return -1;
+
+    return fs_lseek(&(cur_pcb_ptr->pcb_fds[fd]), offset, whence);
+}
+
+/* syscall_pread
+ *
+ * Inputs: fd -- an open regular file
+ *         buf, nbytes
+ *         offset -- where to read the file from, the fourth argument (esi)
+ * Outputs: bytes read, 0 at the end of the file, -1 for failure
+ * Side Effects: the position of fd does not move
+ */
+int32_t syscall_pread(int32_t fd, void *buf, int32_t nbytes, uint32_t offset)
+{
+    if (fd < 2 || fd > 7 || nbytes < 0)
+        return -1;
+
+    if (cur_pcb_ptr->pcb_fds[fd].flags == FREE)
+        return -1;
+
+    if (!vm_user_range(buf, nbytes))
+        return -1;
+
+    return fs_pread(&(cur_pcb_ptr->pcb_fds[fd]), buf, nbytes, offset);
+}
+
+// above: 24 syscalls
 //! ===================================================================================
 // below: helpers
 
 /* get_pcb_ptr
  *
- * Inputs: -user_input
- * Outputs: 0 for success, -1 for failure
- * Side Effects: perform execute
- * Reference: OSdev
+ * Inputs: pid
+ * Outputs: the PCB of the pid, NULL if the pid is not in use
+ * Side Effects: None
  */
 PCB_t *get_pcb_ptr(int32_t pid)
 {
-    return (PCB_t *)(_8M - (pid + 1) * _8K);
+    if (pid < 0 || pid >= PID_MAX)
+        return NULL;
+    return pcb_table[pid];
 }
 
-// scan the bitmap for pcb (6 elements in total)
 /*
- * record_process
- * Description: allocate a new pid
+ * orphan_children
+ * Description: a process is halting, nobody will wait for its children any more
+ *  Inputs: pid of the halting process
+ *  Outputs: None
+ * Side Effects: halted children are freed, running ones free themselves when they halt.
+ */
+void orphan_children(int32_t pid)
+{
+    PCB_t *child;
+    int32_t i;
+
+    for (i = 0; i < PID_MAX; i++)
+    {
+        child = pcb_table[i];
+        if (child == NULL || i == pid || child->parent_pid != pid)
+            continue;
+
+        if (child->flag == ZOMBIE)
+        {
+            child->flag = NONE;
+            decord_process(i);
+        }
+        else
+        {
+            child->detached = 1;
+        }
+    }
+}
+
+/*
+ * process_table_init
+ * Description: put every pid on the free list
  *  Inputs: None
  *  Outputs: None
  * Side Effects: None.
  */
-int32_t record_process(void)
+void process_table_init(void)
 {
     int i;
-    int new_pid = -1;
-    for (i = 0; i < 6; i++)
+
+    // lowest pids first, so the base shells get 0, 1 and 2
+    for (i = 0; i < PID_MAX; i++)
     {
-        if (0 == pcb_bitmap[i])
-        {
-            new_pid = i;
-            pcb_bitmap[i] = 1;
-            break;
-        }
+        pcb_table[i] = NULL;
+        pid_free_list[i] = (i + 1 < PID_MAX) ? i + 1 : -1;
+    }
+    pid_free_head = 0;
+}
+
+/*
+ * free_process
+ * Description: free the PCB and kernel stack of a pid and give the pid back
+ *  Inputs: pid
+ *  Outputs: None
+ * Side Effects: None.
+ */
+static void free_process(int32_t pid)
+{
+    free_frames((uint32_t)pcb_table[pid], PCB_ORDER);
+    pcb_table[pid] = NULL;
+    pid_free_list[pid] = pid_free_head;
+    pid_free_head = pid;
+}
+
+/*
+ * record_process
+ * Description: allocate a new pid, with a PCB and kernel stack for it
+ *  Inputs: None
+ *  Outputs: the pid, -1 if we ran out of pids or memory
+ * Side Effects: None.
+ */
+int32_t record_process(void)
+{
+    int32_t new_pid;
+    PCB_t *pcb;
+
+    if (pending_free_pid != -1 && pending_free_pid != cur_pid)
+    {
+        free_process(pending_free_pid);
+        pending_free_pid = -1;
     }
 
+    if (pid_free_head == -1)
+        return -1;
+
+    pcb = (PCB_t *)alloc_frames(PCB_ORDER);
+    if (pcb == NULL)
+        return -1;
+    memset(pcb, 0, sizeof(PCB_t));
+
+    new_pid = pid_free_head;
+    pid_free_head = pid_free_list[new_pid];
+    pcb_table[new_pid] = pcb;
+    pcb->pid = new_pid;
+
     return new_pid;
 }
 
 /*
  * decord_process
- * Description: deallocate a new pid
+ * Description: deallocate a pid
  *  Inputs: pid
- *  Outputs: None
- * Side Effects: None.
+ *  Outputs: 0 for success, -1 if the pid is not in use
+ * Side Effects: a halting process is still running on its kernel stack, so its
+ *               PCB is only freed once some other process gets here.
  */
 int32_t decord_process(int32_t pid)
 {
-    if (pcb_bitmap[pid] == 0)
+    if (pid < 0 || pid >= PID_MAX || pcb_table[pid] == NULL)
         return -1;
 
-    pcb_bitmap[pid] = 0;
+    if (pending_free_pid != -1 && pending_free_pid != cur_pid)
+    {
+        free_process(pending_free_pid);
+        pending_free_pid = -1;
+    }
+
+    if (pid == cur_pid)
+        pending_free_pid = pid;
+    else
+        free_process(pid);
     return 0;
 }
 
@@ -498,7 +828,7 @@ int32_t decord_process(int32_t pid)
  * Inputs: input_command
  *         file_name
  *         command
- * Outputs: none
+ * Outputs: 0, -1 if the program name is longer than FNAME_MAX_LEN
  * Side Effects: parse the argument
  * Reference: OSdev
  */
@@ -510,8 +840,8 @@ int parse_args(const int8_t *user_input, int8_t *parsed_fname, int8_t *parsed_ar
     int flag;
     int length;
     int i;
-    memset(parsed_fname, 0, 50);
-    memset(parsed_args, 0, 50);
+    memset(parsed_fname, 0, FNAME_MAX_LEN + 1);
+    memset(parsed_args, 0, ARG_LEN);
     while (*user_input == ' ')
         user_input++;
 
@@ -521,10 +851,12 @@ int parse_args(const int8_t *user_input, int8_t *parsed_fname, int8_t *parsed_ar
     {
         if (!flag)
         {
-            if (*user_input != ' ')
-                parsed_fname[i] = *(user_input++); // read next char
-            else
+            if (*user_input == ' ')
                 flag = 1;
+            else if (i >= FNAME_MAX_LEN)
+                return -1; // the name does not fit
+            else
+                parsed_fname[i] = *(user_input++); // read next char
         }
         else
         {
@@ -540,36 +872,14 @@ int parse_args(const int8_t *user_input, int8_t *parsed_fname, int8_t *parsed_ar
 
 /* setup_paging_and_flush_tlb
  *
- * Inputs: physical_addr
+ * Inputs: pid
  * Outputs: none
- * Side Effects: set up the paging for current process and flush tlb
+ * Side Effects: switch CR3 to the page directory of the process, the TLB keeps global pages
  * Reference: OSdev
  */
 void setup_paging_and_flush_tlb(int pid)
 {
-    int32_t physical_addr = pid + 2;
-    page_dir_entry_u the_page_dir_entry;
-    page_dir_entry_4MB_t *pde = &(the_page_dir_entry.kernel_page_desc);
-    pde->present = 1; // in memory.
-    pde->r_w = 1;
-
-    pde->user_super = 1;    // May be accessed by all.
-    pde->write_through = 0; // Write back.
-    pde->cache_disable = 0; // Enable page caching.
-    pde->accessed = 0;      // Have not been read during virtual address translation.
-    pde->dirty = 0;         // Have not been written.
-    pde->pageSize = 1;      // 4MB page for kernel space
-    pde->global = 0;        // Global page ignore
-    pde->avail = 0;         // Not used.
-    pde->pg_attri = 0;      // Reserved and be set to 0.
-    pde->addr_0 = 0;        // Bits 39-32 of address.
-    pde->reserved = 0;
-    pde->pg_addr = (uint32_t)physical_addr; // Bits 31-12 of address.
-
-    // write into page_dir_base
-    page_dir_base[128 / 4] = the_page_dir_entry;
-
-    flush_tlb();
+    load_page_dir(get_pcb_ptr(pid)->page_dir);
 }
 
 /*
@@ -613,76 +923,192 @@ void init_file_table(PCB_t *pcb)
     }
 }
 
-//! ===================================================================================
-
 /*
- * schedule
- * Description: switch to the next process
- *  Inputs: None
- *  Outputs: None
+ * parse_background
+ * Description: strip a trailing '&' from the command
+ *  Inputs: parsed file name and arguments
+ *  Outputs: 1 if the program should run in the background, 0 otherwise
  * Side Effects: None.
  */
-void schedule(void)
+uint8_t parse_background(int8_t *file_name, int8_t *args)
 {
-    // declare local variables here
-    terminal_t *next_terminal;
-    int next_pid;
-    PCB_t *next_pcb_ptr;
+    int8_t *str = (args[0] != '\0') ? args : file_name;
+    int32_t len = strlen(str);
 
-    //================== save "current" info =======================
+    while (len > 0 && str[len - 1] == ' ')
+        len--;
+    if (len == 0 || str[len - 1] != '&')
+        return 0;
 
-    running_term_ptr->pid = cur_pid;
+    len--;
+    while (len > 0 && str[len - 1] == ' ')
+        len--;
+    str[len] = '\0';
+    return 1;
+}
 
-    if (cur_pid != -1)
+/*
+ * check_program
+ * Description: look up an executable and check its ELF magic
+ *  Inputs: file name, dentry to fill in
+ *  Outputs: 0 for success, -1 for failure
+ * Side Effects: None.
+ */
+int32_t check_program(const int8_t *file_name, dentry_t *dentry)
+{
+    int8_t first_four_bytes[4];
+    int read_result;
+
+    if (read_dentry_by_name(file_name, dentry) == -1)
     {
-        cur_pcb_ptr->tss_esp0 = tss.esp0;
-        asm volatile(
-            "movl %%esp, %0     \n\t"
-            "movl %%ebp, %1     \n\t"
-            : "=r"(cur_pcb_ptr->esp), "=r"(cur_pcb_ptr->ebp));
+        printf("read_by_name fails\n");
+        return -1;
     }
 
-    //================== update "current" info =======================
-    next_terminal = running_term_ptr->next_term_to_run;
-    next_pid = next_terminal->pid;
-    next_pcb_ptr = get_pcb_ptr(next_pid);
-    running_term_ptr = next_terminal;
-
-    cur_pcb_ptr = next_pcb_ptr;
-    cur_pid = next_pid;
+    read_result = read_data(dentry->nr_inode, 0, first_four_bytes, 4);
 
-    //================== if there is no process in the new terminal, then start base shell =======================
-    if (next_pid == -1)
+    if (-1 == read_result ||
+        first_four_bytes[0] != 0x7F ||
+        first_four_bytes[1] != 0x45 ||
+        first_four_bytes[2] != 0x4c ||
+        first_four_bytes[3] != 0x46)
     {
-        launch_base_shell(next_terminal->tid);
-        printf("This should not be printed!\n");
+        printf("Checking ELF fails\n");
+        return -1;
     }
 
-    //================== set up new process paging =======================
+    return 0;
+}
+
+/*
+ * load_program
+ * Description: give a pid a new, empty address space backed by the program image
+ *  Inputs: dentry of the program, pid
+ *  Outputs: user entry point, 0 when out of memory
+ * Side Effects: nothing is copied here, see vm_exec
+ */
+uint32_t load_program(dentry_t *dentry, int32_t pid)
+{
+    PCB_t *pcb = get_pcb_ptr(pid);
+    uint32_t user_eip;
+
+    if (sizeof(user_eip) != read_data(dentry->nr_inode, PROGRAM_ENTRY_POINT, (int8_t *)&user_eip, sizeof(user_eip)))
+        return 0;
+
+    if (-1 == vm_exec(pcb, dentry->nr_inode))
+        return 0;
+
+    return user_eip;
+}
+
+/*
+ * create_process
+ * Description: load a program into a new pid and put it on the run queue
+ *  Inputs: pid, dentry of the program, arguments, terminal, parent pid, detached flag
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: the process starts running at its next time slice.
+ */
+int32_t create_process(int32_t pid, dentry_t *dentry, const int8_t *args, struct terminal_t *term,
+                    int32_t parent_pid, uint8_t detached)
+{
+    PCB_t *pcb = get_pcb_ptr(pid);
+    uint32_t user_eip;
+    uint32_t *stack;
 
-    setup_paging_and_flush_tlb(next_pid);
+    user_eip = load_program(dentry, pid);
+    if (user_eip == 0)
+        return -1;
 
-    //================== restore next program's reg info =======================
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = next_pcb_ptr->tss_esp0;
+    pcb->pid = pid;
+    pcb->parent_pid = parent_pid;
+    pcb->vidmap_flag = 0;
+    pcb->detached = detached;
+    pcb->wait_child = 0;
+    pcb->exit_status = 0;
+    pcb->term = term;
+    pcb->fpu_state = NULL;
+    sched_init_pcb(pcb, (parent_pid == -1) ? DEFAULT_PRIO : get_pcb_ptr(parent_pid)->static_prio);
+    init_file_table(pcb);
+    strncpy(pcb->args, args, ARG_LEN);
+
+    pcb->tss_esp0 = (uint32_t)pcb + _8K - 4;
+
+    // build the stack switch_context expects: iret frame, return into process_entry, 4 callee-saved regs
+    stack = (uint32_t *)pcb->tss_esp0;
+    *(--stack) = USER_DS;
+    *(--stack) = _128M + _4M - 4;
+    *(--stack) = USER_EFLAGS;
+    *(--stack) = USER_CS;
+    *(--stack) = user_eip;
+    *(--stack) = (uint32_t)process_entry;
+    *(--stack) = 0; // ebp
+    *(--stack) = 0; // ebx
+    *(--stack) = 0; // esi
+    *(--stack) = 0; // edi
+    pcb->esp = (uint32_t)stack;
+
+    sched_enqueue(pcb);
+    return 0;
+}
+
+/*
+ * restart_base_shell
+ * Description: reload "shell" into the current pid and jump to it
+ *  Inputs: None
+ *  Outputs: None
+ * Side Effects: never returns, the kernel stack of the current process is reset.
+ */
+void restart_base_shell(void)
+{
+    dentry_t dentry;
+    uint32_t user_eip;
+
+    if (-1 == check_program("shell", &dentry))
+        return;
+
+    user_eip = load_program(&dentry, cur_pid);
+    if (user_eip == 0)
+        return;
+    setup_paging_and_flush_tlb(cur_pid);
+    init_file_table(cur_pcb_ptr);
+    memset(cur_pcb_ptr->args, 0, ARG_LEN);
 
     asm volatile(
         "movl %0, %%esp     \n\t"
-        "movl %1, %%ebp     \n\t"
+        "pushl %1           \n\t"
+        "pushl %2           \n\t"
+        "pushl %3           \n\t"
+        "pushl %4           \n\t"
+        "pushl %5           \n\t"
+        "iret               \n\t"
         :
-        : "r"(next_pcb_ptr->esp), "r"(next_pcb_ptr->ebp));
-    return;
+        : "r"(cur_pcb_ptr->tss_esp0), "i"(USER_DS), "i"(_128M + _4M - 4), "i"(USER_EFLAGS), "i"(USER_CS), "r"(user_eip)
+        : "memory");
 }
 
 /*
  * launch_base_shell
- * Description: launch a base shell
+ * Description: create the base shell of a terminal
  *  Inputs: terminal id
  *  Outputs: None
  * Side Effects: None.
  */
 void launch_base_shell(int32_t tid)
 {
+    dentry_t dentry;
+    int32_t pid;
+
+    change_vidmem_mapping(tid);
     printf("========>>> TERMINAL ID: %d                        \n", tid);
-    syscall_execute((uint8_t *)"shell");
+    change_vidmem_mapping(running_term_ptr->tid);
+
+    if (-1 == check_program("shell", &dentry))
+        return;
+
+    pid = record_process();
+    if (pid == -1)
+        return;
+
+    if (-1 == create_process(pid, &dentry, "", terminal_addr(tid), -1, 0))
+        decord_process(pid);
 }
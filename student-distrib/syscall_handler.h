@@ -3,27 +3,37 @@
 
 #include "types.h"
 #include "fs.h"
+#include "fpu.h"
+#include "paging.h"
 
 //! -----------------------------------------------------------------------------------
 
-#define MAX_NUM_PROCESS 6
+#define PID_MAX 1024   // size of the process table
+#define PCB_ORDER 1    // a PCB and its kernel stack are one 8KB block from the frame allocator
 #define PROGRAM_ENTRY_POINT 24
 
 #define NONE 0      // no process
 #define RUNNABLE 1  // process in the run queue
 #define EXPIRED 2   // process used up its time slice, in the expired queue
 #define SUSPENDED 3 // shell under user program
+#define ZOMBIE 4    // halted, waiting for the parent to collect its status
 
 #define USER_START 0x8000000
 #define USER_END 0x8400000
 #define FISH_MAP 0x84b8000
 
+#define SYSCALL_FRAME_WORDS 14 // iret frame from ring 3 (5) + registers pushed by syscall_entry (9)
+
 #define ARG_LEN 128
-#define FNAME_MAX_LEN 32
+#define FNAME_MAX_LEN (FS_PATH_MAX - 1) // programs may be named by path
 #define PROGRAM_VIR_ADDR 0x08048000
 
 //! -----------------------------------------------------------------------------------
 
+struct terminal_t;
+struct image;
+struct vm_area;
+
 // PCB
 typedef struct PCB
 {
@@ -33,20 +43,57 @@ typedef struct PCB
     uint32_t vidmap_flag;  //determine whether a process has get the vidmap return value
 
     // regs and stack info
-    uint32_t esp;
-    uint32_t ebp;
+    uint32_t esp; // kernel esp saved by switch_context
     uint32_t tss_esp0;
 
     int8_t args[ARG_LEN];
 
     // scheduling info
-    uint32_t counts;
-    uint8_t flag; // RUNNABLE, EXPIRED, etc
+    uint32_t counts;  // PIT ticks left in the time slice
+    uint8_t flag;     // RUNNABLE, EXPIRED, etc
+    int32_t static_prio; // from the nice value
+    int32_t prio;        // static_prio adjusted by the interactivity bonus
+    uint32_t sleep_avg;  // recent sleep time in ticks, bigger means more interactive
+    uint32_t sleep_start; // sched clock tick when the process blocked
+    uint64_t run_start;   // TSC when the process was last charged
+    uint64_t run_cycles;  // cycles run but not charged yet, less than a tick after each charge
+    uint8_t detached; // background job, nobody waits for its status
+    uint8_t wait_child; // blocked in execute or wait until a child becomes a zombie
+    uint16_t exit_status;
+    struct terminal_t *term; // terminal the process reads from and writes to
+    struct PCB *next_run;    // run queue link
+
+    // own page directory, user space page tables are allocated when something is first mapped there
+    page_dir_entry_u *page_dir;
+    struct image *image;  // executable mapped at PROGRAM_VIR_ADDR, shared through the image cache
+    uint32_t brk_start;   // heap starts on the page after the image
+    uint32_t brk;         // current break, moved by sbrk
+    struct vm_area *mmaps; // areas handed out by mmap, sorted by address
+
+    // FPU/SSE registers, allocated on the first #NM, NULL for integer-only processes
+    fpu_state_t *fpu_state;
 
     file_entry pcb_fds[8]; // keep track of files open for this process
 
 } PCB_t;
 
+// filled in by the sysinfo system call
+typedef struct sysinfo
+{
+    uint64_t total_cycles; // TSC cycles since the scheduler started
+    uint64_t idle_cycles;  // part of total_cycles spent halted in the idle task
+    uint32_t total_frames; // 4KB frames of RAM the frame allocator manages
+    uint32_t free_frames;
+    uint32_t heap_bytes;   // frames held by kmalloc
+    uint32_t heap_used;    // live kmalloc objects, rounded up to their size class
+    uint32_t heap_allocs;  // kmalloc calls since boot
+    uint32_t heap_frees;
+    uint32_t bcache_hits;  // reads of compressed files served from the decompressed block cache
+    uint32_t bcache_misses;
+    uint32_t dcache_hits;  // path lookups served from the dentry cache
+    uint32_t dcache_misses;
+} sysinfo_t;
+
 //! -----------------------------------------------------------------------------------
 
 extern int32_t syscall_halt(uint8_t status);
@@ -59,22 +106,41 @@ extern int32_t syscall_getargs(uint8_t *buf, int32_t nbytes);
 extern int32_t syscall_vidmap(uint8_t **screen_start);
 extern int32_t syscall_sethandler(int32_t signum, void *handler_address);
 extern int32_t syscall_sigreturn(void);
+extern int32_t syscall_sysinfo(sysinfo_t *info);
+extern int32_t syscall_setpriority(int32_t pid, int32_t nice);
+extern int32_t syscall_fork(void);
+extern int32_t syscall_wait(int32_t *status);
+extern int32_t syscall_create(const uint8_t *filename);
+extern int32_t syscall_unlink(const uint8_t *filename);
+extern int32_t syscall_truncate(const uint8_t *filename, uint32_t length);
+extern int32_t syscall_getdents(int32_t fd, dirent_t *buf, uint32_t nbytes);
+extern int32_t syscall_fstat(int32_t fd, fs_stat_t *st);
+extern int32_t syscall_lseek(int32_t fd, int32_t offset, int32_t whence);
+extern int32_t syscall_pread(int32_t fd, void *buf, int32_t nbytes, uint32_t offset);
 
 extern int parse_args(const int8_t *input_command, int8_t *args, int8_t *command);
 extern void setup_paging_and_flush_tlb(int pid);
 extern int32_t decord_process(int32_t pid);
 extern PCB_t * get_pcb_ptr(int32_t pid);
 extern int32_t record_process(void);
+extern void process_table_init(void);
+extern void orphan_children(int32_t pid);
 extern void init_file_table(PCB_t *pcb);
-extern void schedule(void);
+extern uint8_t parse_background(int8_t *file_name, int8_t *args);
+extern int32_t check_program(const int8_t *file_name, dentry_t *dentry);
+extern uint32_t load_program(dentry_t *dentry, int32_t pid);
+extern int32_t create_process(int32_t pid, dentry_t *dentry, const int8_t *args, struct terminal_t *term,
+                           int32_t parent_pid, uint8_t detached);
+extern void restart_base_shell(void);
 extern void launch_base_shell(int32_t tid);
 
 //! -----------------------------------------------------------------------------------
 
 extern int usr_programs_remaining; // decrement every usr programs (also shells but not base shells)
 extern int cur_pid;                // scheduler should control this!
+extern PCB_t *cur_pcb_ptr;
 extern int8_t args[3][50];         // 3 user argument buffers
 extern int8_t command[3][50];      // 3 command buffers
-extern int8_t pcb_bitmap[MAX_NUM_PROCESS];
+extern PCB_t *pcb_table[PID_MAX];
 
 #endif
@@ -47,9 +47,9 @@ void terminal_init(void)
     for (i = 0; i < 3; i++)
     {
         term_arr[i].tid = i;
-        term_arr[i].pid = -1;
         term_arr[i].buf_pos = 0;
         term_arr[i].kbd_buf_ready = 0;
+        wait_queue_init(&(term_arr[i].kbd_wait_queue));
         term_arr[i].cursor_x = 0;
         term_arr[i].cursor_y = 0;
         term_arr[i].vidmap_flag = 0;
@@ -65,10 +65,19 @@ void terminal_init(void)
     term_arr[0].vid_mem_buffer = VIDEO_START + _4K;
     term_arr[1].vid_mem_buffer = VIDEO_START + _8K;
     term_arr[2].vid_mem_buffer = VIDEO_START + _12K;
+}
 
-    term_arr[0].next_term_to_run = &(term_arr[1]);
-    term_arr[1].next_term_to_run = &(term_arr[2]);
-    term_arr[2].next_term_to_run = &(term_arr[0]);
+/*
+ * terminal_addr
+ * Description: get the terminal struct of a terminal id
+ *  Inputs:
+ *      - term_id: terminal id
+ *  Outputs: terminal pointer
+ * Side Effects: None.
+ */
+terminal_t *terminal_addr(int term_id)
+{
+    return &(term_arr[term_id]);
 }
 
 /*
@@ -185,7 +194,7 @@ void switch_terminal(int target_tid)
  *  Inputs:
  *      - tid: terminal id
  *  Outputs: None
- * Side Effects: None.
+ * Side Effects: invlpg the two pages that moved, the rest of the TLB stays.
  */
 void change_vidmem_mapping(int tid)
 {
@@ -195,7 +204,8 @@ void change_vidmem_mapping(int tid)
     screen_y_ptr = &term_arr[tid].cursor_y;
     temp_flag = (tid != viewing_term_ptr->tid);
     switch_fish_paging(tid, temp_flag);
-    flush_tlb();
+    invlpg(VIDEO_START);
+    invlpg(VIDMAP_ADDR);
 }
 
 /*
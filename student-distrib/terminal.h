@@ -4,6 +4,7 @@
 #include "types.h"
 #include "keyboard.h"
 #include "syscall_handler.h"
+#include "sched.h"
 
 #define TERM_NUM 3
 
@@ -28,22 +29,19 @@
     * modify `vidmap` system call, allocating different virtual address for different termial!
     *  
     */
-// the unit of scheduling
 typedef struct terminal_t {
     int tid;
-    int pid;
 
     char kbd_buf[ARG_LEN];
     int buf_pos;
     volatile int kbd_buf_ready;
+    wait_queue_t kbd_wait_queue; // processes blocked in terminal_read
 
     int cursor_x;
     int cursor_y;
 
     uint32_t vid_mem_buffer;
     uint32_t vidmap_flag;
-
-    struct terminal_t *next_term_to_run;
 } terminal_t;
 
 /* =========================== function declarations =========================== */
@@ -0,0 +1,516 @@
+#include "vm.h"
+#include "paging.h"
+#include "mm.h"
+#include "kmalloc.h"
+#include "image.h"
+#include "fs.h"
+#include "exception_handler.h"
+#include "lib.h"
+
+/*
+ * alloc_user_frame
+ * Description: allocate a frame for a user page, squeezing the image cache if memory is short
+ *  Inputs: None
+ *  Outputs: physical address, 0 when out of memory
+ * Side Effects: None.
+ */
+static uint32_t alloc_user_frame(void)
+{
+    uint32_t paddr = alloc_frames(0);
+
+    if (paddr == 0 && image_cache_shrink() != 0)
+        paddr = alloc_frames(0);
+    return paddr;
+}
+
+/*
+ * reload_user_space
+ * Description: make page table changes in [start, end) visible if the process is the running one
+ *  Inputs: pcb, start, end -- page aligned
+ *  Outputs: None
+ * Side Effects: invlpg, or flush tlb for big ranges
+ */
+static void reload_user_space(PCB_t *pcb, uint32_t start, uint32_t end)
+{
+    if (pcb != cur_pcb_ptr)
+        return;
+
+    if (end - start == _4K)
+        flush_user_page(start);
+    else
+        flush_user_range(start, end);
+}
+
+/*
+ * find_vma
+ * Description: find the mmap area holding an address
+ *  Inputs: pcb, addr
+ *  Outputs: the area, NULL if addr is not mapped
+ * Side Effects: None.
+ */
+static vm_area_t *find_vma(PCB_t *pcb, uint32_t addr)
+{
+    vm_area_t *vma;
+
+    for (vma = pcb->mmaps; vma != NULL && vma->start <= addr; vma = vma->next)
+    {
+        if (addr < vma->end)
+            return vma;
+    }
+    return NULL;
+}
+
+/*
+ * insert_vma
+ * Description: find a free range of the mmap area and create a vm_area for it, first fit
+ *  Inputs: pcb, length -- page aligned, flags, inode -- for VMA_FILE
+ *  Outputs: the new area, NULL if there is no room or out of memory
+ * Side Effects: None.
+ */
+static vm_area_t *insert_vma(PCB_t *pcb, uint32_t length, uint32_t flags, uint32_t inode)
+{
+    vm_area_t *vma;
+    vm_area_t **link = &(pcb->mmaps);
+    uint32_t start = MMAP_START;
+
+    while (*link != NULL && (*link)->start - start < length)
+    {
+        start = (*link)->end;
+        link = &((*link)->next);
+    }
+    if (start > MMAP_END || MMAP_END - start < length)
+        return NULL;
+
+    vma = kmalloc(sizeof(vm_area_t));
+    if (vma == NULL)
+        return NULL;
+    vma->start = start;
+    vma->end = start + length;
+    vma->flags = flags;
+    vma->inode = inode;
+    vma->pgoff = 0;
+    vma->next = *link;
+    *link = vma;
+    if (flags & VMA_FILE)
+        fs_inode_get(inode, 1);
+    return vma;
+}
+
+/*
+ * free_vma
+ * Description: free a vm_area that is off the list
+ *  Inputs: vma
+ *  Outputs: None
+ * Side Effects: a file mapping drops its reference to the file.
+ */
+static void free_vma(vm_area_t *vma)
+{
+    if (vma->flags & VMA_FILE)
+        fs_inode_put(vma->inode, 1);
+    kfree(vma);
+}
+
+/*
+ * unmap_range
+ * Description: drop every page mapped in [start, end)
+ *  Inputs: pcb, start, end -- page aligned
+ *  Outputs: None
+ * Side Effects: the caller reloads the page tables.
+ */
+static void unmap_range(PCB_t *pcb, uint32_t start, uint32_t end)
+{
+    uint32_t addr;
+
+    for (addr = start; addr < end; addr += _4K)
+        unmap_user_page(pcb->page_dir, addr);
+}
+
+/*
+ * vm_exec
+ * Description: set up an empty address space for an executable
+ *  Inputs: pcb, inode of the program file
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: nothing is copied here, the page-fault handler maps each page of
+ *               the image the first time it is touched (see demand_page).
+ */
+int32_t vm_exec(PCB_t *pcb, uint32_t inode)
+{
+    pcb->image = image_get(inode);
+    if (pcb->image == NULL)
+        return -1;
+
+    pcb->page_dir = alloc_page_dir();
+    if (pcb->page_dir == NULL)
+    {
+        image_put(pcb->image);
+        pcb->image = NULL;
+        return -1;
+    }
+
+    pcb->brk_start = (PROGRAM_VIR_ADDR + pcb->image->length + _4K - 1) & ~(_4K - 1);
+    pcb->brk = pcb->brk_start;
+    pcb->mmaps = NULL;
+    return 0;
+}
+
+/*
+ * vm_fork
+ * Description: share every page of the parent with the child copy-on-write
+ *  Inputs: parent -- the running process, child -- a fresh PCB
+ *  Outputs: 0 for success, -1 when out of memory
+ * Side Effects: flush tlb, the parent's writable pages turned copy-on-write too.
+ */
+int32_t vm_fork(PCB_t *parent, PCB_t *child)
+{
+    vm_area_t *vma;
+    vm_area_t **link = &(child->mmaps);
+
+    child->mmaps = NULL;
+    child->page_dir = alloc_page_dir();
+    if (child->page_dir == NULL)
+        return -1;
+
+    for (vma = parent->mmaps; vma != NULL; vma = vma->next)
+    {
+        *link = kmalloc(sizeof(vm_area_t));
+        if (*link == NULL)
+        {
+            vm_release(child);
+            return -1;
+        }
+        **link = *vma;
+        (*link)->next = NULL;
+        if (vma->flags & VMA_FILE)
+            fs_inode_get(vma->inode, 1);
+        link = &((*link)->next);
+    }
+
+    if (-1 == fork_page_tables(parent->page_dir, child->page_dir))
+    {
+        vm_release(child);
+        return -1;
+    }
+    flush_tlb(); // every writable page changed, kernel mappings are global and survive
+
+    child->image = parent->image;
+    image_dup(child->image);
+    child->brk_start = parent->brk_start;
+    child->brk = parent->brk;
+    return 0;
+}
+
+/*
+ * vm_release
+ * Description: free the address space of a process
+ *  Inputs: pcb of a halting process, or of a process about to exec again
+ *  Outputs: None
+ * Side Effects: a running process switches to the kernel's page directory first.
+ */
+void vm_release(PCB_t *pcb)
+{
+    vm_area_t *vma;
+
+    if (pcb->page_dir != NULL)
+    {
+        if (pcb == cur_pcb_ptr)
+            load_page_dir(NULL);
+        free_page_dir(pcb->page_dir);
+        pcb->page_dir = NULL;
+    }
+
+    while (pcb->mmaps != NULL)
+    {
+        vma = pcb->mmaps;
+        pcb->mmaps = vma->next;
+        free_vma(vma);
+    }
+
+    image_put(pcb->image);
+    pcb->image = NULL;
+}
+
+/*
+ * demand_page
+ * Description: back a not-present user page. Pages of the image map the shared
+ *              copy from the image cache copy-on-write. File mappings map the data
+ *              block in the fs image itself, read-only. Heap, stack and anonymous
+ *              mmap pages get a private zero-filled frame.
+ *  Inputs: pcb of the faulting process, faulting address
+ *  Outputs: 0 for success, -1 if nothing should be mapped there or out of memory
+ * Side Effects: flush tlb
+ */
+static int32_t demand_page(PCB_t *pcb, uint32_t addr)
+{
+    uint32_t page = addr & ~(_4K - 1);
+    uint32_t paddr;
+    vm_area_t *vma;
+
+    if (pcb->page_dir == NULL)
+        return -1;
+
+    if (page >= PROGRAM_VIR_ADDR && page < PROGRAM_VIR_ADDR + pcb->image->length)
+    {
+        paddr = image_page(pcb->image, (page - PROGRAM_VIR_ADDR) / _4K);
+        if (paddr == 0)
+            return -1;
+        frame_get(paddr);
+        if (-1 == map_user_page(pcb->page_dir, page, paddr, PAGE_COW))
+        {
+            frame_put(paddr);
+            return -1;
+        }
+        reload_user_space(pcb, page, page + _4K);
+        return 0;
+    }
+
+    vma = find_vma(pcb, page);
+    if (vma != NULL && (vma->flags & VMA_FILE))
+    {
+        // no copy and no frame reference, the fs image stays in memory for good
+        paddr = fs_block_addr(vma->inode, vma->pgoff + (page - vma->start) / _4K);
+        if (paddr == 0)
+            return -1; // past the end of the file
+        if (-1 == map_user_page(pcb->page_dir, page, paddr, PAGE_SHARED))
+            return -1;
+        reload_user_space(pcb, page, page + _4K);
+        return 0;
+    }
+
+    if (!(page >= pcb->brk_start && page < pcb->brk) &&
+        !(page >= USER_END - USER_STACK_MAX && page < USER_END) &&
+        vma == NULL)
+        return -1;
+
+    // the frame is reached through the kernel's direct mapping, not through user space
+    paddr = alloc_user_frame();
+    if (paddr == 0)
+        return -1;
+    memset((void *)paddr, 0, _4K);
+    if (-1 == map_user_page(pcb->page_dir, page, paddr, PAGE_RW))
+    {
+        frame_put(paddr);
+        return -1;
+    }
+    reload_user_space(pcb, page, page + _4K);
+    return 0;
+}
+
+/*
+ * copy_on_write
+ * Description: a write hit a copy-on-write page, give the process its own copy,
+ *              or just make the page writable if nobody else maps the frame
+ *  Inputs: pcb of the faulting process, faulting address
+ *  Outputs: 0 for success, -1 if it is not a copy-on-write page or out of memory
+ * Side Effects: flush tlb
+ */
+static int32_t copy_on_write(PCB_t *pcb, uint32_t addr)
+{
+    page_table_entry_t *pte;
+    uint32_t old_paddr, new_paddr;
+
+    pte = user_pte(pcb->page_dir, addr, 0);
+    if (pte == NULL || !pte->present || !(pte->avail & PTE_AVAIL_COW))
+        return -1;
+
+    old_paddr = pte->pg_addr << OFFSET_12;
+    if (frame_ref(old_paddr) == 1)
+    {
+        pte->r_w = 1;
+        pte->avail &= ~PTE_AVAIL_COW;
+    }
+    else
+    {
+        new_paddr = alloc_user_frame();
+        if (new_paddr == 0)
+            return -1;
+        memcpy((void *)new_paddr, (void *)old_paddr, _4K);
+        map_user_page(pcb->page_dir, addr & ~(_4K - 1), new_paddr, PAGE_RW);
+        frame_put(old_paddr);
+    }
+
+    reload_user_space(pcb, addr & ~(_4K - 1), (addr & ~(_4K - 1)) + _4K);
+    return 0;
+}
+
+/*
+ * vm_user_range
+ * Description: check a buffer a system call got from user space, the program window,
+ *              stack, vidmap and mmap areas all count
+ *  Inputs: addr -- start of the buffer, size -- bytes
+ *  Outputs: 1 if the whole buffer is in user space, 0 otherwise
+ * Side Effects: None. Whether the pages are mapped is up to the page-fault handler.
+ */
+int32_t vm_user_range(const void *addr, uint32_t size)
+{
+    return (uint32_t)addr >= USER_START && (uint32_t)addr < MMAP_END && size <= MMAP_END - (uint32_t)addr;
+}
+
+/*
+ * vm_fault
+ * Description: page fault in user space, fill in the page or resolve copy-on-write
+ *  Inputs: pcb of the running process, faulting address, error code from the CPU
+ *  Outputs: 0 if the instruction can be retried, -1 if the access is bad
+ * Side Effects: None.
+ */
+int32_t vm_fault(PCB_t *pcb, uint32_t addr, uint32_t error_code)
+{
+    if (addr < USER_START || addr >= MMAP_END)
+        return -1;
+
+    if (!(error_code & PF_PRESENT))
+        return demand_page(pcb, addr);
+    if (error_code & PF_WRITE)
+        return copy_on_write(pcb, addr);
+    return -1;
+}
+
+//! ===================================================================================
+
+/* syscall_sbrk
+ *
+ * Inputs: increment -- bytes to grow (or, negative, shrink) the heap by
+ * Outputs: the old break, -1 for failure
+ * Side Effects: heap pages are zero-filled on first touch, pages given back are freed
+ * Reference: OSdev
+ */
+int32_t syscall_sbrk(int32_t increment)
+{
+    PCB_t *pcb = cur_pcb_ptr;
+    uint32_t old_brk = pcb->brk;
+    uint32_t new_brk = old_brk + increment;
+    uint32_t start, end;
+
+    if (increment > 0 && (new_brk < old_brk || new_brk > USER_END - USER_STACK_MAX))
+        return -1;
+    if (increment < 0 && (new_brk > old_brk || new_brk < pcb->brk_start))
+        return -1;
+
+    cli();
+    pcb->brk = new_brk;
+    if (increment < 0)
+    {
+        start = (new_brk + _4K - 1) & ~(_4K - 1);
+        end = (old_brk + _4K - 1) & ~(_4K - 1);
+        unmap_range(pcb, start, end);
+        reload_user_space(pcb, start, end);
+    }
+    sti();
+
+    return old_brk;
+}
+
+/* syscall_mmap
+ *
+ * Inputs: addr -- ignored, the kernel picks the address
+ *         length -- bytes, rounded up to whole pages
+ *         fd -- an open regular file, or -1 for anonymous memory
+ * Outputs: start of the mapping, -1 for failure
+ * Side Effects: anonymous pages are zero-filled on first touch. A file is mapped
+ *               read-only from its first byte, straight from the fs image, and
+ *               touching a page past its end kills the process.
+ * Reference: OSdev
+ */
+int32_t syscall_mmap(void *addr, uint32_t length, int32_t fd)
+{
+    vm_area_t *vma;
+    file_entry *file = NULL;
+
+    if (length == 0 || length > MMAP_END - MMAP_START)
+        return -1;
+    length = (length + _4K - 1) & ~(_4K - 1);
+
+    if (fd != -1)
+    {
+        if (fd < 2 || fd > 7)
+            return -1;
+        file = &(cur_pcb_ptr->pcb_fds[fd]);
+        if (file->flags != IN_USE || file->op_ptr != (uint32_t)&regular_file_ops)
+            return -1;
+    }
+
+    cli();
+    if (file == NULL)
+        vma = insert_vma(cur_pcb_ptr, length, VMA_ANON, 0);
+    else
+        vma = insert_vma(cur_pcb_ptr, length, VMA_FILE, file->inode);
+    sti();
+
+    if (vma == NULL)
+        return -1;
+    return vma->start;
+}
+
+/* syscall_munmap
+ *
+ * Inputs: addr -- page aligned start, length -- bytes, rounded up to whole pages
+ * Outputs: 0 for success, -1 for failure
+ * Side Effects: any part of an area can be unmapped, an area may split in two
+ * Reference: OSdev
+ */
+int32_t syscall_munmap(void *addr, uint32_t length)
+{
+    PCB_t *pcb = cur_pcb_ptr;
+    uint32_t start = (uint32_t)addr;
+    uint32_t end;
+    vm_area_t *vma, *tail;
+    vm_area_t **link;
+
+    if ((start & (_4K - 1)) || length == 0 || start < MMAP_START || start >= MMAP_END ||
+        length > MMAP_END - start)
+        return -1;
+    end = start + ((length + _4K - 1) & ~(_4K - 1));
+
+    cli();
+
+    link = &(pcb->mmaps);
+    while (*link != NULL && (*link)->start < end)
+    {
+        vma = *link;
+        if (vma->end <= start)
+        {
+            link = &(vma->next);
+            continue;
+        }
+
+        if (vma->start < start && vma->end > end)
+        {
+            // a hole in the middle, split in two
+            tail = kmalloc(sizeof(vm_area_t));
+            if (tail == NULL)
+            {
+                sti();
+                return -1;
+            }
+            *tail = *vma;
+            tail->start = end;
+            tail->pgoff += (end - vma->start) / _4K;
+            if (tail->flags & VMA_FILE)
+                fs_inode_get(tail->inode, 1);
+            vma->end = start;
+            vma->next = tail;
+            break;
+        }
+        else if (vma->start < start)
+        {
+            vma->end = start;
+            link = &(vma->next);
+        }
+        else if (vma->end > end)
+        {
+            vma->pgoff += (end - vma->start) / _4K;
+            vma->start = end;
+            break;
+        }
+        else
+        {
+            *link = vma->next;
+            free_vma(vma);
+        }
+    }
+
+    unmap_range(pcb, start, end);
+    reload_user_space(pcb, start, end);
+
+    sti();
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef _VM_H
+#define _VM_H
+
+#include "types.h"
+#include "syscall_handler.h"
+
+/* user address space
+ *   128MB                         program window: image, then the sbrk heap
+ *   132MB - USER_STACK_MAX ~ 132MB  stack, grows down from USER_END
+ *   132MB ~ 136MB                 vidmap
+ *   136MB ~ 192MB                 mmap areas
+ */
+#define USER_STACK_MAX 0x100000 // 1MB, sbrk stops below it
+#define MMAP_START 0x8800000    // 136MB
+#define MMAP_END 0xC000000      // 192MB, end of user space
+
+/* vm_area flags */
+#define VMA_ANON 0x1 // zero-filled on first touch
+#define VMA_FILE 0x2 // data blocks of a file in the fs image, mapped read-only
+
+#ifndef ASM
+
+// a range of user space handed out by mmap, [start, end) is page aligned
+typedef struct vm_area
+{
+    uint32_t start;
+    uint32_t end;
+    uint32_t flags;
+    uint32_t inode;   // VMA_FILE only
+    uint32_t pgoff;   // VMA_FILE only, block of the file mapped at start
+    struct vm_area *next; // sorted by address
+} vm_area_t;
+
+/* =========================== function declarations =========================== */
+
+extern int32_t syscall_sbrk(int32_t increment);
+extern int32_t syscall_mmap(void *addr, uint32_t length, int32_t fd);
+extern int32_t syscall_munmap(void *addr, uint32_t length);
+
+// set up an empty address space running an executable, pages come in on demand
+extern int32_t vm_exec(PCB_t *pcb, uint32_t inode);
+// give a forked child a copy-on-write copy of the parent's address space
+extern int32_t vm_fork(PCB_t *parent, PCB_t *child);
+// free the whole address space of a process
+extern void vm_release(PCB_t *pcb);
+// 1 if a buffer passed to a system call lies inside user space
+extern int32_t vm_user_range(const void *addr, uint32_t size);
+// page-fault handler body, 0 if the faulting instruction can be retried
+extern int32_t vm_fault(PCB_t *pcb, uint32_t addr, uint32_t error_code);
+
+#endif /* ASM */
+#endif /* _VM_H */
@@ -3,32 +3,55 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define NR_DIRENTS 32
+#define NAME_WIDTH 33
+#define SIZE_WIDTH 8
+
+/* print s, then spaces up to width (right aligned if right is set) */
+static void
+put_field (uint8_t* s, int32_t width, int32_t right)
+{
+    int32_t pad = width - (int32_t)ece391_strlen (s);
+
+    if (!right)
+        ece391_fdputs (1, s);
+    while (pad-- > 0)
+        ece391_fdputs (1, (uint8_t*)" ");
+    if (right)
+        ece391_fdputs (1, s);
+}
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i;
+    uint8_t path[128];
+    uint8_t num[16];
+    ece391_dirent_t ents[NR_DIRENTS];
+
+    if (0 != ece391_getargs (path, 128) || path[0] == '\0')
+        ece391_strcpy (path, (uint8_t*)".");
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    if (-1 == (fd = ece391_open (path))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* one syscall returns a batch of entries with their type and size */
+    while (0 != (cnt = ece391_getdents (fd, ents, sizeof (ents)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-
-        ece391_fdputs (1, (uint8_t *)"try to write...\n");
-        int result = ece391_write (1, buf, cnt + 1);
 
-	    if (-1 == result)
-	        return 3;
+        for (i = 0; i < cnt / (int32_t)sizeof (ece391_dirent_t); i++) {
+            put_field (ents[i].name, NAME_WIDTH, 0);
+            put_field ((ents[i].type == ECE391_DIR) ? (uint8_t*)"dir" :
+                       (ents[i].type == ECE391_RTC) ? (uint8_t*)"rtc" : (uint8_t*)"file", 5, 0);
+            put_field (ece391_itoa (ents[i].length, num, 10), SIZE_WIDTH, 1);
+            ece391_fdputs (1, (uint8_t*)"\n");
+        }
     }
 
+    ece391_close (fd);
     return 0;
 }
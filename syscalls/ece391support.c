@@ -102,3 +102,108 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * malloc/free: blocks up to MALLOC_MAX_SMALL bytes come from power-of-two size
+ * classes carved out of sbrk pages and are recycled through a free list per
+ * class. Bigger blocks get their own mmap and go back to the kernel on free.
+ * Every block starts with an 8-byte header, so user memory stays 8-byte aligned.
+ */
+#define MALLOC_PAGE        4096
+#define MALLOC_MIN_SHIFT   4     /* smallest class is 16 bytes, header included */
+#define MALLOC_NR_CLASSES  8     /* 16 ~ 2048 */
+#define MALLOC_MAX_SMALL   ((1 << (MALLOC_MIN_SHIFT + MALLOC_NR_CLASSES - 1)) - sizeof(malloc_hdr_t))
+#define MALLOC_BIG         MALLOC_NR_CLASSES
+
+typedef struct malloc_hdr {
+    uint32_t size_class;  /* class index, MALLOC_BIG for mmap'd blocks */
+    uint32_t length;      /* bytes mapped for a big block, block size otherwise */
+} malloc_hdr_t;
+
+/* a free block reuses its user area as the list link */
+typedef struct malloc_free {
+    malloc_hdr_t hdr;
+    struct malloc_free* next;
+} malloc_free_t;
+
+static malloc_free_t* malloc_free_list[MALLOC_NR_CLASSES];
+
+/* Carve a fresh sbrk page into blocks of one size class */
+static int32_t malloc_refill(uint32_t size_class)
+{
+    uint32_t block = 1 << (MALLOC_MIN_SHIFT + size_class);
+    uint8_t* page = ece391_sbrk(MALLOC_PAGE);
+    uint32_t off;
+    malloc_free_t* b;
+
+    if (page == (uint8_t*)-1) {
+        return -1;
+    }
+
+    for (off = 0; off + block <= MALLOC_PAGE; off += block) {
+        b = (malloc_free_t*)(page + off);
+        b->hdr.size_class = size_class;
+        b->hdr.length = block;
+        b->next = malloc_free_list[size_class];
+        malloc_free_list[size_class] = b;
+    }
+    return 0;
+}
+
+/* Allocate size bytes, 0 when out of memory */
+void* ece391_malloc(uint32_t size)
+{
+    uint32_t size_class = 0;
+    uint32_t length;
+    malloc_hdr_t* hdr;
+    malloc_free_t* b;
+
+    if (size > MALLOC_MAX_SMALL) {
+        if (size > 0xFFFFFFFF - MALLOC_PAGE) {
+            return 0;
+        }
+        length = (size + sizeof(malloc_hdr_t) + MALLOC_PAGE - 1) & ~(MALLOC_PAGE - 1);
+        hdr = ece391_mmap(0, length, -1);
+        if (hdr == (malloc_hdr_t*)-1) {
+            return 0;
+        }
+        hdr->size_class = MALLOC_BIG;
+        hdr->length = length;
+        return hdr + 1;
+    }
+
+    while ((1U << (MALLOC_MIN_SHIFT + size_class)) < size + sizeof(malloc_hdr_t)) {
+        size_class++;
+    }
+
+    if (malloc_free_list[size_class] == 0 && malloc_refill(size_class) != 0) {
+        return 0;
+    }
+    b = malloc_free_list[size_class];
+    malloc_free_list[size_class] = b->next;
+    return &(b->hdr) + 1;
+}
+
+/* Give back a block from ece391_malloc, 0 is ignored */
+void ece391_free(void* ptr)
+{
+    malloc_hdr_t* hdr;
+    malloc_free_t* b;
+
+    if (ptr == 0) {
+        return;
+    }
+
+    hdr = (malloc_hdr_t*)ptr - 1;
+    if (hdr->size_class == MALLOC_BIG) {
+        ece391_munmap(hdr, hdr->length);
+        return;
+    }
+    if (hdr->size_class >= MALLOC_NR_CLASSES) {
+        return;   /* not ours */
+    }
+
+    b = (malloc_free_t*)hdr;
+    b->next = malloc_free_list[hdr->size_class];
+    malloc_free_list[hdr->size_class] = b;
+}
@@ -22,6 +22,84 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/* CPU time since boot and how much of it the kernel spent idle,
+   physical memory in 4KB frames, kernel heap usage in bytes, and how
+   often reads of compressed files found their block decompressed and
+   path lookups found their dentry cached */
+typedef struct ece391_sysinfo {
+	uint64_t total_cycles;
+	uint64_t idle_cycles;
+	uint32_t total_frames;
+	uint32_t free_frames;
+	uint32_t heap_bytes;
+	uint32_t heap_used;
+	uint32_t heap_allocs;
+	uint32_t heap_frees;
+	uint32_t bcache_hits;
+	uint32_t bcache_misses;
+	uint32_t dcache_hits;
+	uint32_t dcache_misses;
+} ece391_sysinfo_t;
+
+extern int32_t ece391_sysinfo (ece391_sysinfo_t* info);
+
+/* nice value -20 (best) ~ 19 (worst), pid < 0 means the calling process */
+extern int32_t ece391_setpriority (int32_t pid, int32_t nice);
+
+/* child pid in the parent, 0 in the child; the child shares memory copy-on-write */
+extern int32_t ece391_fork (void);
+/* wait for a forked child to halt, returns its pid, -1 if there are no children */
+extern int32_t ece391_wait (int32_t* status);
+
+/* move the end of the heap by increment bytes, returns the old end, (void*)-1 on failure */
+extern void* ece391_sbrk (int32_t increment);
+/* map length bytes of zero-filled memory (fd -1), or read-only the data of an
+   open file (no copy, touching past the end of the file kills the process);
+   addr is only a hint, returns the start of the mapping, (void*)-1 on failure */
+extern void* ece391_mmap (void* addr, uint32_t length, int32_t fd);
+extern int32_t ece391_munmap (void* addr, uint32_t length);
+
+/* the filesystem lives in RAM, files written here are gone after a reboot;
+   write grows a file past its end, truncate pads it with zeros or cuts it,
+   unlink fails while a process is running the file */
+extern int32_t ece391_create (const uint8_t* fname);
+extern int32_t ece391_unlink (const uint8_t* fname);
+extern int32_t ece391_truncate (const uint8_t* fname, uint32_t length);
+
+/* file types */
+#define ECE391_RTC     0
+#define ECE391_DIR     1
+#define ECE391_REGULAR 2
+
+/* one record of getdents, length in bytes (a directory's is 64 per entry) */
+typedef struct ece391_dirent {
+	uint8_t name[36];	/* EOS terminated */
+	uint32_t type;
+	uint32_t inode;
+	uint32_t length;
+} ece391_dirent_t;
+
+/* fill buf with as many records as fit from an open directory, returns the
+   bytes filled, 0 at the end of the directory, -1 on failure */
+extern int32_t ece391_getdents (int32_t fd, ece391_dirent_t* buf, uint32_t nbytes);
+
+/* type, inode and size in bytes of an open file, directory or rtc */
+typedef struct ece391_stat {
+	uint32_t type;
+	uint32_t inode;
+	uint32_t length;
+} ece391_stat_t;
+
+#define ECE391_SEEK_SET 0
+#define ECE391_SEEK_CUR 1
+#define ECE391_SEEK_END 2
+
+extern int32_t ece391_fstat (int32_t fd, ece391_stat_t* st);
+/* regular files only, returns the new position, -1 on failure */
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+/* read at offset, the position of fd stays where it is */
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
@@ -11,5 +11,19 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_SYSINFO 11
+#define SYS_SETPRIORITY 12
+#define SYS_FORK 13
+#define SYS_WAIT 14
+#define SYS_SBRK 15
+#define SYS_MMAP 16
+#define SYS_MUNMAP 17
+#define SYS_CREATE 18
+#define SYS_UNLINK 19
+#define SYS_TRUNCATE 20
+#define SYS_GETDENTS 21
+#define SYS_FSTAT 22
+#define SYS_LSEEK 23
+#define SYS_PREAD 24
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,86 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define FNAME      ((uint8_t*)"wbench.tmp")
+#define SMALL_SIZE 32
+#define SMALL_CNT  4096
+#define LARGE_SIZE 16384
+#define LARGE_CNT  64
+
+static uint8_t buf[LARGE_SIZE];
+
+/* Kcycles since boot, the kernel counts cycles in 64 bits and we only divide 32-bit numbers */
+static uint32_t
+kcycles (void)
+{
+    ece391_sysinfo_t info;
+
+    if (-1 == ece391_sysinfo (&info))
+        return 0;
+    return (uint32_t)(info.total_cycles >> 10);
+}
+
+static void
+report (const uint8_t* name, uint32_t bytes, uint32_t start)
+{
+    uint8_t num[16];
+    uint32_t elapsed = kcycles () - start;
+
+    if (elapsed == 0)
+        elapsed = 1;
+    ece391_fdputs (1, name);
+    ece391_fdputs (1, ece391_itoa (bytes, num, 10));
+    ece391_fdputs (1, (uint8_t*)" bytes in ");
+    ece391_fdputs (1, ece391_itoa (elapsed, num, 10));
+    ece391_fdputs (1, (uint8_t*)" Kcycles, ");
+    ece391_fdputs (1, ece391_itoa (bytes / elapsed, num, 10));
+    ece391_fdputs (1, (uint8_t*)" bytes/Kcycle\n");
+}
+
+/* write the same amount with many small and with a few large writes */
+static int32_t
+run (const uint8_t* name, uint32_t size, uint32_t cnt)
+{
+    int32_t fd;
+    uint32_t i, start;
+
+    if (-1 == ece391_create (FNAME)) {
+        ece391_fdputs (1, (uint8_t*)"create failed\n");
+        return -1;
+    }
+    if (-1 == (fd = ece391_open (FNAME))) {
+        ece391_fdputs (1, (uint8_t*)"open failed\n");
+        ece391_unlink (FNAME);
+        return -1;
+    }
+
+    start = kcycles ();
+    for (i = 0; i < cnt; i++) {
+        if ((int32_t)size != ece391_write (fd, buf, size)) {
+            ece391_fdputs (1, (uint8_t*)"write failed\n");
+            break;
+        }
+    }
+    report (name, i * size, start);
+
+    ece391_close (fd);
+    ece391_unlink (FNAME);
+    return (i == cnt) ? 0 : -1;
+}
+
+int main ()
+{
+    uint32_t i;
+
+    for (i = 0; i < LARGE_SIZE; i++)
+        buf[i] = (uint8_t)i;
+
+    ece391_unlink (FNAME); // left over from a run that was killed
+    if (-1 == run ((uint8_t*)"small writes: ", SMALL_SIZE, SMALL_CNT))
+        return 2;
+    if (-1 == run ((uint8_t*)"large writes: ", LARGE_SIZE, LARGE_CNT))
+        return 2;
+    return 0;
+}